@@ -0,0 +1,303 @@
+#include "Analysis.hpp"
+
+#include <Samplette/SampleStore.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+
+namespace Samplette
+{
+namespace
+{
+template <typename Vec, typename Proj>
+auto closest_in(const Vec& vec, int64_t frame, Proj proj) noexcept
+{
+  auto it = std::lower_bound(
+      vec.begin(),
+      vec.end(),
+      frame,
+      [&](const auto& elt, int64_t f) { return proj(elt) < f; });
+  if (it == vec.end())
+    return vec.end() - 1;
+  if (it == vec.begin())
+    return it;
+
+  auto prev = it - 1;
+  return (frame - proj(*prev)) <= (proj(*it) - frame) ? prev : it;
+}
+
+double correlation(const float* a, const float* b, int64_t n) noexcept
+{
+  double ab{}, aa{}, bb{};
+  for (int64_t i = 0; i < n; i++)
+  {
+    ab += a[i] * b[i];
+    aa += a[i] * a[i];
+    bb += b[i] * b[i];
+  }
+
+  const double norm = std::sqrt(aa * bb);
+  return norm > 1e-12 ? ab / norm : 0.;
+}
+
+// Dominant period of the sample, looked for in an excerpt of its middle
+// part: it is the first autocorrelation peak past the first dip which is
+// close to the highest one, so that we do not pick a multiple of it.
+int64_t dominant_period(const std::vector<float>& mono)
+{
+  constexpr int64_t min_lag = 16;
+  constexpr int64_t max_lag = 4096;
+  constexpr int64_t excerpt = 16384;
+
+  const int64_t frames = mono.size();
+  const int64_t len = std::min(frames, excerpt);
+  const int64_t max_l = std::min(max_lag, len / 2);
+  if (max_l <= min_lag + 2)
+    return 0;
+
+  const float* data = mono.data() + (frames - len) / 2;
+  const int64_t n = len - max_l;
+
+  std::vector<double> r(max_l);
+  for (int64_t lag = min_lag; lag < max_l; lag++)
+    r[lag] = correlation(data, data + lag, n);
+
+  int64_t first = min_lag;
+  while (first < max_l && r[first] >= 0.)
+    first++;
+  // No dip, e.g. the excerpt is silent
+  if (first >= max_l)
+    return 0;
+
+  const double best = *std::max_element(r.begin() + first, r.end());
+  if (best <= 0.)
+    return 0;
+
+  for (int64_t lag = first + 1; lag < max_l - 1; lag++)
+  {
+    if (r[lag] >= 0.9 * best && r[lag] >= r[lag - 1] && r[lag] >= r[lag + 1])
+      return lag;
+  }
+  return 0;
+}
+}
+
+int64_t sample_analysis::snap_to_zero_crossing(int64_t frame) const noexcept
+{
+  if (zero_crossings.empty())
+    return frame;
+
+  return *closest_in(zero_crossings, frame, [](int64_t f) { return f; });
+}
+
+int64_t sample_analysis::snap_to_loop_point(
+    int64_t frame,
+    int64_t min,
+    int64_t max) const noexcept
+{
+  if (!loop_points.empty())
+  {
+    const auto it = closest_in(
+        loop_points, frame, [](const loop_point& p) { return p.frame; });
+    if (it->frame >= min && it->frame < max)
+      return it->frame;
+  }
+
+  const int64_t zc = snap_to_zero_crossing(frame);
+  return (zc >= min && zc < max) ? zc : frame;
+}
+
+sample_region make_region(
+    int64_t frames,
+    double start,
+    double length,
+    double loop_start,
+    const sample_analysis* snap) noexcept
+{
+  if (frames <= 0)
+    return {};
+
+  int64_t begin = std::clamp<int64_t>(frames * start, 0, frames - 1);
+  if (snap)
+    begin = std::clamp<int64_t>(
+        snap->snap_to_zero_crossing(begin), 0, frames - 1);
+
+  int64_t end = begin + (frames - begin) * length;
+  if (snap)
+    end = snap->snap_to_zero_crossing(end);
+  end = std::clamp<int64_t>(end, begin + 1, frames);
+
+  int64_t loop = begin + (frames - begin) * loop_start;
+  if (snap)
+    loop = snap->snap_to_loop_point(loop, begin, end);
+  loop = std::clamp<int64_t>(loop, begin, end - 1);
+
+  return sample_region{begin, end - begin, loop - begin};
+}
+
+bool sample_analysis::silent(
+    int64_t first,
+    int64_t last,
+    float level) const noexcept
+{
+  if (first < 0 || last < first || last >= frames)
+    return false;
+  const int64_t end = last / peak_block;
+  if (end >= int64_t(block_peaks.size()))
+    return false;
+  for (int64_t b = first / peak_block; b <= end; b++)
+    if (block_peaks[b] >= level)
+      return false;
+  return true;
+}
+
+namespace
+{
+// Peaks of frames [first; first + frames) of a channel
+void add_peaks(
+    sample_analysis& res,
+    const float* chan,
+    int64_t first,
+    int64_t frames) noexcept
+{
+  constexpr int64_t block = sample_analysis::peak_block;
+  for (int64_t i = 0; i < frames;)
+  {
+    const int64_t n = std::min(frames - i, block - (first + i) % block);
+    float& peak = res.block_peaks[(first + i) / block];
+    for (int64_t j = 0; j < n; j++)
+      peak = std::max(peak, std::abs(chan[i + j]));
+    i += n;
+  }
+}
+
+// Zero crossings and loop points, from the mono downmix
+void analyze_mono(sample_analysis& res, const std::vector<float>& mono)
+{
+  const int64_t frames = mono.size();
+
+  // Zero crossings: we keep whichever of the two frames around the
+  // crossing is the closest to zero.
+  for (int64_t i = 1; i < frames; i++)
+  {
+    if (mono[i - 1] < 0.f && mono[i] >= 0.f)
+    {
+      res.zero_crossings.push_back(-mono[i - 1] < mono[i] ? i - 1 : i);
+    }
+  }
+
+  // Loop points: zero crossings in regions which are stable over a period
+  res.period = dominant_period(mono);
+  if (res.period > 0)
+  {
+    constexpr std::size_t max_candidates = 4096;
+    const int64_t window = std::min<int64_t>(2048, 4 * res.period);
+    const std::size_t stride = 1 + res.zero_crossings.size() / max_candidates;
+
+    for (std::size_t i = 0; i < res.zero_crossings.size(); i += stride)
+    {
+      const int64_t f = res.zero_crossings[i];
+      if (f + res.period + window > frames)
+        break;
+
+      const float score = correlation(
+          mono.data() + f, mono.data() + f + res.period, window);
+      if (score >= sample_analysis::good_loop_score)
+        res.loop_points.push_back({f, score});
+    }
+  }
+}
+}
+
+std::shared_ptr<const sample_analysis>
+analyze_sample(std::span<const float* const> channels, int64_t frames)
+{
+  auto res = std::make_shared<sample_analysis>();
+  res->frames = frames;
+  if (channels.empty() || frames <= 1)
+    return res;
+
+  constexpr int64_t block = sample_analysis::peak_block;
+  res->block_peaks.resize((frames + block - 1) / block);
+  for (const float* chan : channels)
+    add_peaks(*res, chan, 0, frames);
+
+  std::vector<float> mono(frames);
+  for (const float* chan : channels)
+    for (int64_t i = 0; i < frames; i++)
+      mono[i] += chan[i];
+
+  analyze_mono(*res, mono);
+  return res;
+}
+
+std::shared_ptr<const sample_analysis>
+analyze_sample(const sample_store& store)
+{
+  auto res = std::make_shared<sample_analysis>();
+  const int64_t frames = store.frames;
+  res->frames = frames;
+  if (store.size() == 0 || frames <= 1)
+    return res;
+
+  constexpr int64_t block = sample_analysis::peak_block;
+  res->block_peaks.resize((frames + block - 1) / block);
+
+  // Decoded a few blocks at a time, only the downmix is kept whole
+  std::vector<float> mono(frames);
+  std::vector<float> chunk(16 * block);
+  for (std::size_t c = 0; c < store.size(); c++)
+  {
+    for (int64_t i = 0; i < frames; i += chunk.size())
+    {
+      const int64_t n = std::min<int64_t>(chunk.size(), frames - i);
+      store.decode(c, i, n, chunk.data());
+      add_peaks(*res, chunk.data(), i, n);
+      for (int64_t j = 0; j < n; j++)
+        mono[i + j] += chunk[j];
+    }
+  }
+
+  analyze_mono(*res, mono);
+  return res;
+}
+
+namespace
+{
+struct analysis_cache
+{
+  std::mutex mutex;
+  std::map<std::string, std::weak_ptr<const sample_analysis>> entries;
+
+  static analysis_cache& instance()
+  {
+    static analysis_cache cache;
+    return cache;
+  }
+};
+}
+
+std::shared_ptr<const sample_analysis> cached_analysis(const std::string& path)
+{
+  auto& cache = analysis_cache::instance();
+  std::lock_guard lock{cache.mutex};
+  if (auto it = cache.entries.find(path); it != cache.entries.end())
+  {
+    if (auto ptr = it->second.lock())
+      return ptr;
+    cache.entries.erase(it);
+  }
+  return {};
+}
+
+void cache_analysis(
+    const std::string& path,
+    const std::shared_ptr<const sample_analysis>& analysis)
+{
+  auto& cache = analysis_cache::instance();
+  std::lock_guard lock{cache.mutex};
+  cache.entries[path] = analysis;
+}
+}
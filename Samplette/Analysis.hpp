@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Samplette
+{
+struct sample_store;
+
+// Offline analysis of a decoded sample, used to snap the playback region
+// boundaries to positions which will not click.
+struct sample_analysis
+{
+  struct loop_point
+  {
+    int64_t frame{};
+    // Normalized autocorrelation at the dominant period, in [-1; 1]
+    float score{};
+  };
+
+  // Minimal score for a zero crossing to be kept as a loop point
+  static constexpr const float good_loop_score{0.8f};
+
+  // Frame positions where the mono downmix crosses zero upwards, sorted
+  std::vector<int64_t> zero_crossings;
+
+  // Zero crossings in regions stable enough to loop on, sorted by frame
+  std::vector<loop_point> loop_points;
+
+  int64_t frames{};
+  int64_t period{};
+
+  // Largest absolute value over all the channels of each block of
+  // peak_block frames, so that playback can tell silent parts without
+  // reading them
+  static constexpr const int64_t peak_block{1024};
+  std::vector<float> block_peaks;
+
+  // Whether frames [first; last] all stay under `level`
+  [[nodiscard]] bool
+  silent(int64_t first, int64_t last, float level) const noexcept;
+
+  [[nodiscard]] int64_t snap_to_zero_crossing(int64_t frame) const noexcept;
+
+  // Looks for the closest good loop point in [min, max),
+  // falls back to the closest zero crossing.
+  [[nodiscard]] int64_t
+  snap_to_loop_point(int64_t frame, int64_t min, int64_t max) const noexcept;
+};
+
+// Playback region of a sample, in frames.
+// loop_start is relative to start, as the "Loop start" control is.
+struct sample_region
+{
+  int64_t start{};
+  int64_t length{};
+  int64_t loop_start{};
+};
+
+// start, length and loop_start are the control values in [0; 1].
+// If an analysis is given the boundaries are snapped to it.
+[[nodiscard]] sample_region make_region(
+    int64_t frames,
+    double start,
+    double length,
+    double loop_start,
+    const sample_analysis* snap) noexcept;
+
+[[nodiscard]] std::shared_ptr<const sample_analysis>
+analyze_sample(std::span<const float* const> channels, int64_t frames);
+
+// Same analysis, from a compressed copy of the sample
+[[nodiscard]] std::shared_ptr<const sample_analysis>
+analyze_sample(const sample_store& store);
+
+// Analyses are shared across all the processes which use the same file,
+// and live as long as one of them keeps them.
+[[nodiscard]] std::shared_ptr<const sample_analysis>
+cached_analysis(const std::string& path);
+void cache_analysis(
+    const std::string& path,
+    const std::shared_ptr<const sample_analysis>& analysis);
+}
@@ -0,0 +1,307 @@
+#include "BatchImport.hpp"
+
+#include <score/tools/std/Invoke.hpp>
+
+#include <Samplette/Freeze.hpp>
+#include <Samplette/Zones.hpp>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <cmath>
+#include <span>
+
+namespace Samplette
+{
+namespace
+{
+bool is_word_char(char c) noexcept
+{
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+         || (c >= 'A' && c <= 'Z') || c == '#' || c == '-';
+}
+
+bool is_number(std::string_view word) noexcept
+{
+  return !word.empty()
+         && std::all_of(
+             word.begin(),
+             word.end(),
+             [](char c) { return c >= '0' && c <= '9'; });
+}
+
+// Resamples a channel with linear interpolation. Only used at import: the
+// samples of a multisample must share the rate of the sound.
+void convert_rate(
+    std::span<const float> in,
+    double ratio,
+    float* out,
+    int64_t frames) noexcept
+{
+  const int64_t last = int64_t(in.size()) - 1;
+  for (int64_t j = 0; j < frames; j++)
+  {
+    const double p = j * ratio;
+    const int64_t idx = std::min<int64_t>(p, last);
+    const double frac = p - idx;
+    const float next = in[std::min(idx + 1, last)];
+    out[j] = in[idx] + frac * (next - in[idx]);
+  }
+}
+}
+
+int note_from_file_name(std::string_view name) noexcept
+{
+  if (const auto dot = name.rfind('.'); dot != std::string_view::npos)
+    name = name.substr(0, dot);
+
+  // Words are read from the end, and the parts of "A2-127" one by one
+  // when the whole is not a note such as "C-1"
+  int number = -1;
+  auto check = [&](std::string_view word)
+  {
+    const int note = parse_note(word);
+    if (note < 0)
+      return false;
+    if (!is_number(word))
+      return true;
+    if (number < 0)
+      number = note;
+    return false;
+  };
+
+  std::size_t end = name.size();
+  while (end > 0)
+  {
+    while (end > 0 && !is_word_char(name[end - 1]))
+      end--;
+    std::size_t begin = end;
+    while (begin > 0 && is_word_char(name[begin - 1]))
+      begin--;
+
+    const auto word = name.substr(begin, end - begin);
+    if (check(word))
+      return parse_note(word);
+    if (parse_note(word) < 0)
+    {
+      std::size_t part_end = word.size();
+      while (part_end > 0)
+      {
+        const auto dash = word.rfind('-', part_end - 1);
+        const std::size_t part_begin
+            = dash == std::string_view::npos ? 0 : dash + 1;
+        const auto part = word.substr(part_begin, part_end - part_begin);
+        if (check(part))
+          return parse_note(part);
+        part_end = dash == std::string_view::npos ? 0 : dash;
+      }
+    }
+    end = begin;
+  }
+  return number;
+}
+
+std::shared_ptr<const kit>
+make_multisample_kit(std::vector<imported_sample> samples, std::string name)
+{
+  std::erase_if(
+      samples,
+      [](const imported_sample& s)
+      {
+        return !s.sound || s.sound->data.empty() || s.sound->data[0].empty()
+               || s.sample_rate <= 0;
+      });
+  if (samples.empty())
+    return {};
+  const int rate = samples.front().sample_rate;
+
+  // Samples with a note first, in note order; the others after them in
+  // name order
+  std::stable_sort(
+      samples.begin(),
+      samples.end(),
+      [](const imported_sample& a, const imported_sample& b)
+      {
+        return (a.root < 0 ? 128 : a.root) < (b.root < 0 ? 128 : b.root);
+      });
+
+  std::vector<imported_sample> kept;
+  std::size_t channels = 0;
+  int last = -1;
+  for (auto& s : samples)
+  {
+    if (s.root < 0)
+      s.root = last < 0 ? 60 : last + 1;
+    if (s.root <= last || s.root > 127)
+    {
+      qWarning() << "Samplette: no key left for" << s.name.c_str();
+      continue;
+    }
+    last = s.root;
+    channels = std::max(channels, s.sound->data.size());
+    kept.push_back(std::move(s));
+  }
+  if (kept.size() > std::size_t(max_key_samples))
+    kept.resize(max_key_samples);
+
+  multisample map{};
+  int64_t total = 0;
+  for (std::size_t k = 0; k < kept.size(); k++)
+  {
+    const auto& s = kept[k];
+    const double ratio = double(s.sample_rate) / rate;
+    auto& ks = map.samples[map.count++];
+    ks.start = total;
+    ks.length = std::max<int64_t>(
+        1, std::ceil((s.sound->data[0].size() - 1) / ratio) + 1);
+    ks.root = s.root;
+    ks.low = k == 0 ? 0 : map.samples[k - 1].high + 1;
+    ks.high = k + 1 == kept.size() ? 127 : (s.root + kept[k + 1].root) / 2;
+    total += ks.length;
+  }
+
+  auto sound = std::make_shared<ossia::audio_data>();
+  sound->data.resize(channels);
+  for (auto& chan : sound->data)
+    chan.resize(total);
+  for (int k = 0; k < map.count; k++)
+  {
+    const auto& in = kept[k].sound->data;
+    const auto& ks = map.samples[k];
+    const double ratio = double(kept[k].sample_rate) / rate;
+    for (std::size_t c = 0; c < channels; c++)
+    {
+      // Mono samples play on all the channels
+      const auto& src = in[std::min(c, in.size() - 1)];
+      float* out = sound->data[c].data() + ks.start;
+      if (kept[k].sample_rate == rate)
+        std::copy_n(src.data(), ks.length, out);
+      else
+        convert_rate({src.data(), src.size()}, ratio, out, ks.length);
+    }
+  }
+  sound->path = name;
+
+  auto res = std::make_shared<kit>();
+  res->controls.emplace_back("Key map", multisample_to_string(map));
+  res->sample_name = std::move(name);
+  res->sound = std::move(sound);
+  res->sample_rate = rate;
+  return res;
+}
+
+QStringList sample_files(const QList<QUrl>& urls)
+{
+  QStringList res;
+  auto add = [&](const QFileInfo& info)
+  {
+    if (info.suffix().compare("wav", Qt::CaseInsensitive) == 0)
+      res.push_back(info.absoluteFilePath());
+  };
+
+  for (const auto& url : urls)
+  {
+    if (!url.isLocalFile())
+      continue;
+    const QFileInfo info{url.toLocalFile()};
+    if (info.isDir())
+    {
+      QDirIterator it{
+          info.absoluteFilePath(), QDir::Files, QDirIterator::Subdirectories};
+      while (it.hasNext())
+      {
+        it.next();
+        add(it.fileInfo());
+      }
+    }
+    else
+    {
+      add(info);
+    }
+  }
+
+  res.sort(Qt::CaseInsensitive);
+  res.removeDuplicates();
+  return res;
+}
+
+std::shared_ptr<batch_import> batch_import::start(
+    QStringList files,
+    QString name,
+    QString path,
+    progress_callback progress,
+    finished_callback finished)
+{
+  auto self = std::make_shared<batch_import>();
+  self->m_files = std::move(files);
+  self->m_name = std::move(name);
+  self->m_path = std::move(path);
+  self->m_progress = std::move(progress);
+  self->m_finished = std::move(finished);
+
+  const int n = self->m_files.size();
+  self->m_samples.resize(n);
+  self->m_remaining = n;
+  if (n == 0)
+  {
+    self->assemble();
+    return self;
+  }
+
+  // Decoding is mostly reading and converting: one task per file keeps
+  // the disk and all the cores busy.
+  for (int i = 0; i < n; i++)
+    QThreadPool::globalInstance()->start([self, i] { self->decode(i); });
+  return self;
+}
+
+void batch_import::decode(int index)
+{
+  if (!m_cancelled)
+  {
+    const auto& file = m_files[index];
+    auto& s = m_samples[index];
+    s.name = QFileInfo{file}.fileName().toStdString();
+    s.root = note_from_file_name(s.name);
+    s.sound = read_wav(file.toStdString(), s.sample_rate);
+    if (!s.sound)
+      qWarning() << "Samplette: could not decode" << file;
+
+    const int decoded = ++m_decoded;
+    ossia::qt::run_async(
+        qApp,
+        [self = shared_from_this(), decoded]
+        {
+          if (!self->m_cancelled)
+            self->m_progress(decoded, self->m_files.size());
+        });
+  }
+
+  // The last task sees the samples written by the others
+  if (--m_remaining == 0)
+    assemble();
+}
+
+void batch_import::assemble()
+{
+  std::shared_ptr<const kit> res;
+  if (!m_cancelled)
+  {
+    res = make_multisample_kit(std::move(m_samples), m_name.toStdString());
+    if (res && !write_kit(m_path.toStdString(), *res))
+    {
+      qWarning() << "Samplette: could not save" << m_path;
+      res.reset();
+    }
+  }
+
+  ossia::qt::run_async(
+      qApp,
+      [self = shared_from_this(), res = std::move(res)]
+      { self->m_finished(self->m_cancelled ? nullptr : res); });
+}
+}
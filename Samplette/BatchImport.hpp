@@ -0,0 +1,83 @@
+#pragma once
+#include <Samplette/Kit.hpp>
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QUrl>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Samplette
+{
+// MIDI note of a sample from its file name: the last word of the name
+// which is a note name, else the last one which is a number, e.g.
+// "Piano_C#4_f.wav" or "kick-036.wav". Returns -1 if there is none.
+[[nodiscard]] int note_from_file_name(std::string_view name) noexcept;
+
+// A decoded file of a batch import
+struct imported_sample
+{
+  std::string name;
+  ossia::audio_handle sound;
+  int sample_rate{};
+  int root{-1};
+};
+
+// Lays the samples end to end in one sound and maps them on the keyboard
+// with the "Key map" control: each sample plays from its root note up to
+// halfway to the next one. Samples without a note in their name take the
+// keys after the last one which has, and only the first sample of a note
+// is kept. They are converted to the rate of the first sample and to the
+// largest channel count. Returns null if there is no sample to map.
+[[nodiscard]] std::shared_ptr<const kit>
+make_multisample_kit(std::vector<imported_sample> samples, std::string name);
+
+// The WAV files among the dropped files and in the dropped folders,
+// recursively, in name order.
+[[nodiscard]] QStringList sample_files(const QList<QUrl>& urls);
+
+// Decodes files in parallel on the global thread pool, then makes a kit of
+// them named `name` and saves it to `path` so that documents can load it
+// again. The callbacks are called on the main thread: `progress` after
+// each file, `finished` once, with null if the import failed or was
+// cancelled.
+class batch_import : public std::enable_shared_from_this<batch_import>
+{
+public:
+  using progress_callback = std::function<void(int decoded, int total)>;
+  using finished_callback = std::function<void(std::shared_ptr<const kit>)>;
+
+  [[nodiscard]] static std::shared_ptr<batch_import> start(
+      QStringList files,
+      QString name,
+      QString path,
+      progress_callback progress,
+      finished_callback finished);
+
+  // Files which are not decoded yet are skipped
+  void cancel() noexcept { m_cancelled = true; }
+  bool cancelled() const noexcept { return m_cancelled; }
+
+private:
+  void decode(int index);
+  void assemble();
+
+  QStringList m_files;
+  QString m_name;
+  QString m_path;
+  progress_callback m_progress;
+  finished_callback m_finished;
+
+  // Each task writes its own sample; the last one to finish assembles them
+  std::vector<imported_sample> m_samples;
+  std::atomic_int m_remaining{};
+  std::atomic_int m_decoded{};
+  std::atomic_bool m_cancelled{};
+};
+}
@@ -0,0 +1,39 @@
+#include "Choke.hpp"
+
+#include <map>
+#include <mutex>
+
+namespace Samplette
+{
+namespace
+{
+struct choke_bus_registry
+{
+  std::mutex mutex;
+  std::map<const void*, std::weak_ptr<choke_bus>> entries;
+
+  static choke_bus_registry& instance()
+  {
+    static choke_bus_registry registry;
+    return registry;
+  }
+};
+}
+
+std::shared_ptr<choke_bus> shared_choke_bus(const void* key)
+{
+  auto& registry = choke_bus_registry::instance();
+  std::lock_guard lock{registry.mutex};
+  // Buses of graphs which are gone are dropped along the way
+  std::erase_if(
+      registry.entries, [](const auto& e) { return e.second.expired(); });
+
+  auto& entry = registry.entries[key];
+  if (auto ptr = entry.lock())
+    return ptr;
+
+  auto ptr = std::make_shared<choke_bus>();
+  entry = ptr;
+  return ptr;
+}
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace Samplette
+{
+static constexpr const int max_choke_groups{32};
+
+// Lets the Samplette nodes of an execution graph cut each other: a note on
+// in a choke group bumps the counter of that group, and every node playing
+// in the group fast-releases its voices when it sees the counter move.
+// Only atomics are involved, so that it can be used from any audio thread.
+struct choke_bus
+{
+  // Index 0 is "no group"
+  std::array<std::atomic<uint64_t>, max_choke_groups + 1> triggers{};
+
+  // Called when a node triggers a voice in the group.
+  // Returns the new value of the counter.
+  uint64_t trigger(int group) noexcept
+  {
+    return triggers[group].fetch_add(1, std::memory_order_acq_rel) + 1;
+  }
+
+  [[nodiscard]] uint64_t current(int group) const noexcept
+  {
+    return triggers[group].load(std::memory_order_acquire);
+  }
+};
+
+// Buses are shared by all the nodes which use the same key,
+// e.g. the execution graph, and live as long as one of them keeps them.
+[[nodiscard]] std::shared_ptr<choke_bus> shared_choke_bus(const void* key);
+}
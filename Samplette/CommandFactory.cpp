@@ -1,37 +1,210 @@
+#include <Process/Commands/SetControlValue.hpp>
+
+#include <score/command/Dispatchers/MacroCommandDispatcher.hpp>
+#include <score/model/path/PathSerialization.hpp>
+
 #include <Samplette/CommandFactory.hpp>
 #include <Samplette/Process.hpp>
-#include <score/model/path/PathSerialization.hpp>
 
 namespace Samplette
 {
+namespace
+{
+// Puts back the sample the process had before a command: the loaded file
+// or kit when still in memory, else loaded again from its path, or no
+// sample if it had none.
+void restoreSource(
+    Model& snd,
+    const std::shared_ptr<Media::AudioFile>& file,
+    const QString& filePath,
+    const std::shared_ptr<const kit>& bundle,
+    const QString& kitPath)
+{
+  if (bundle)
+    snd.setKit(bundle, kitPath);
+  else if (!kitPath.isEmpty())
+    snd.loadKit(kitPath);
+  else if (file)
+    snd.setFile(file);
+  else if (!filePath.isEmpty())
+    snd.setFileForced(filePath);
+  else
+    snd.clearSource();
+}
+
+// Sets the controls saved in a kit, then its sample
+template <typename Macro>
+void submitKit(
+    const score::DocumentContext& ctx,
+    const Model& model,
+    const QString& path,
+    std::shared_ptr<const kit> bundle)
+{
+  RedoMacroCommandDispatcher<Macro> disp{ctx.commandStack};
+  for (auto* port : model.inlets())
+  {
+    auto ctl = qobject_cast<Process::ControlInlet*>(port);
+    if (!ctl)
+      continue;
+
+    // Controls are matched by name: kits saved by older versions only set
+    // the controls they knew of.
+    const auto name = ctl->name().toStdString();
+    for (const auto& [key, value] : bundle->controls)
+    {
+      if (key == name && value != ctl->value())
+      {
+        disp.submit(new Process::SetControlValue{*ctl, value});
+        break;
+      }
+    }
+  }
+  disp.submit(new ChangeKit{model, path, std::move(bundle)});
+  disp.commit();
+}
+}
 
 ChangeAudioFile::ChangeAudioFile(
     const Model& model,
     const QString& text)
     : m_model{model}
     , m_new{text}
+    , m_oldKit{model.kitFile()}
+    , m_oldKeyMap{QString::fromStdString(
+          ossia::convert<std::string>(model.key_map->value()))}
+    , m_oldFile{model.file()}
+    , m_oldKitData{model.loadedKit()}
+    , m_oldResults{model.analysis(), model.store()}
 {
-  m_old = model.file()->originalFile();
+  if (m_oldFile)
+    m_old = m_oldFile->originalFile();
 }
 
 void ChangeAudioFile::undo(const score::DocumentContext& ctx) const
 {
   auto& snd = m_model.find(ctx);
-  snd.setFileForced(m_old);
+  m_newResults = {snd.analysis(), snd.store()};
+  snd.key_map->setValue(m_oldKeyMap.toStdString());
+  restoreSource(snd, m_oldFile, m_old, m_oldKitData, m_oldKit);
 }
 
 void ChangeAudioFile::redo(const score::DocumentContext& ctx) const
 {
   auto& snd = m_model.find(ctx);
-  snd.setFileForced(m_new);
+  snd.key_map->setValue(std::string{});
+  if (m_newFile)
+  {
+    snd.setFile(m_newFile);
+  }
+  else
+  {
+    snd.setFileForced(m_new);
+    m_newFile = snd.file();
+  }
 }
 
 void ChangeAudioFile::serializeImpl(DataStreamInput& s) const
 {
-  s << m_model << m_old << m_new;
+  s << m_model << m_old << m_new << m_oldKit << m_oldKeyMap;
 }
 
 void ChangeAudioFile::deserializeImpl(DataStreamOutput& s)
+{
+  s >> m_model >> m_old >> m_new >> m_oldKit >> m_oldKeyMap;
+}
+
+ChangeKit::ChangeKit(
+    const Model& model,
+    const QString& path,
+    std::shared_ptr<const kit> bundle)
+    : m_model{model}
+    , m_oldKit{model.kitFile()}
+    , m_new{path}
+    , m_oldFile{model.file()}
+    , m_oldKitData{model.loadedKit()}
+    , m_newKit{std::move(bundle)}
+    , m_oldResults{model.analysis(), model.store()}
+{
+  if (m_oldFile)
+    m_old = m_oldFile->originalFile();
+}
+
+void ChangeKit::undo(const score::DocumentContext& ctx) const
+{
+  auto& snd = m_model.find(ctx);
+  m_newResults = {snd.analysis(), snd.store()};
+  restoreSource(snd, m_oldFile, m_old, m_oldKitData, m_oldKit);
+}
+
+void ChangeKit::redo(const score::DocumentContext& ctx) const
+{
+  auto& snd = m_model.find(ctx);
+  if (m_newKit)
+  {
+    snd.setKit(m_newKit, m_new);
+  }
+  else
+  {
+    snd.loadKit(m_new);
+    m_newKit = snd.loadedKit();
+  }
+}
+
+void ChangeKit::serializeImpl(DataStreamInput& s) const
+{
+  s << m_model << m_old << m_oldKit << m_new;
+}
+
+void ChangeKit::deserializeImpl(DataStreamOutput& s)
+{
+  s >> m_model >> m_old >> m_oldKit >> m_new;
+}
+
+bool loadKit(
+    const score::DocumentContext& ctx,
+    const Model& model,
+    const QString& path)
+{
+  auto bundle = read_kit(path.toStdString(), false);
+  if (!bundle)
+    return false;
+
+  submitKit<LoadKit>(ctx, model, path, std::move(bundle));
+  return true;
+}
+
+void importKit(
+    const score::DocumentContext& ctx,
+    const Model& model,
+    const QString& path,
+    std::shared_ptr<const kit> bundle)
+{
+  submitKit<ImportSamples>(ctx, model, path, std::move(bundle));
+}
+
+SetFrozen::SetFrozen(const Model& model, const QString& file)
+    : m_model{model}
+    , m_old{model.frozenFile()}
+    , m_new{file}
+{
+}
+
+void SetFrozen::undo(const score::DocumentContext& ctx) const
+{
+  m_model.find(ctx).setFrozenFile(m_old);
+}
+
+void SetFrozen::redo(const score::DocumentContext& ctx) const
+{
+  m_model.find(ctx).setFrozenFile(m_new);
+}
+
+void SetFrozen::serializeImpl(DataStreamInput& s) const
+{
+  s << m_model << m_old << m_new;
+}
+
+void SetFrozen::deserializeImpl(DataStreamOutput& s)
 {
   s >> m_model >> m_old >> m_new;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Samplette/Process.hpp>
+#include <score/command/AggregateCommand.hpp>
 #include <score/command/Command.hpp>
 
 
@@ -13,6 +14,16 @@ inline const CommandGroupKey& CommandFactoryName()
   return key;
 }
 
+// The analysis and compressed copy of a sample. The commands hold the
+// ones of the samples they switch between so that they stay in their
+// caches, and undo and redo do not analyse and compress them again.
+struct sample_results
+{
+  std::shared_ptr<const sample_analysis> analysis;
+  std::shared_ptr<const sample_store> store;
+};
+
+// A single file replaces a multisample: the key map is cleared with it
 class ChangeAudioFile final : public score::Command
 {
   SCORE_COMMAND_DECL(
@@ -34,6 +45,100 @@ protected:
 private:
   Path<Model> m_model;
   QString m_old, m_new;
+  QString m_oldKit;
+  QString m_oldKeyMap;
+
+  // The decoded files are kept for as long as the command lives so that
+  // undo and redo do not decode them again. They are not serialized:
+  // a deserialized command loads the files from their paths.
+  std::shared_ptr<Media::AudioFile> m_oldFile;
+  std::shared_ptr<const kit> m_oldKitData;
+  mutable std::shared_ptr<Media::AudioFile> m_newFile;
+  sample_results m_oldResults;
+  mutable sample_results m_newResults;
+};
+
+// Replaces the sample of the process with the one of a kit bundle. The
+// controls saved in the kit are set by SetControlValue commands next to
+// this one, see loadKit.
+class ChangeKit final : public score::Command
+{
+  SCORE_COMMAND_DECL(CommandFactoryName(), ChangeKit, "Change kit")
+public:
+  ChangeKit(
+      const Model&,
+      const QString& path,
+      std::shared_ptr<const kit> bundle);
+
+  void undo(const score::DocumentContext& ctx) const override;
+  void redo(const score::DocumentContext& ctx) const override;
+
+protected:
+  void serializeImpl(DataStreamInput& s) const override;
+  void deserializeImpl(DataStreamOutput& s) override;
+
+private:
+  Path<Model> m_model;
+  QString m_old, m_oldKit, m_new;
+
+  // Same as ChangeAudioFile: not serialized, reloaded from the paths.
+  std::shared_ptr<Media::AudioFile> m_oldFile;
+  std::shared_ptr<const kit> m_oldKitData;
+  mutable std::shared_ptr<const kit> m_newKit;
+  sample_results m_oldResults;
+  mutable sample_results m_newResults;
+};
+
+class LoadKit final : public score::AggregateCommand
+{
+  SCORE_COMMAND_DECL(CommandFactoryName(), LoadKit, "Load kit")
+};
+
+// Loads a kit bundle in the process as a single undoable command.
+// Returns false if the file is not a valid kit.
+bool loadKit(
+    const score::DocumentContext& ctx,
+    const Model& model,
+    const QString& path);
+
+class ImportSamples final : public score::AggregateCommand
+{
+  SCORE_COMMAND_DECL(CommandFactoryName(), ImportSamples, "Import samples")
+};
+
+// Same as loadKit for the kit made by a batch import, already in memory
+// and saved at `path`.
+void importKit(
+    const score::DocumentContext& ctx,
+    const Model& model,
+    const QString& path,
+    std::shared_ptr<const kit> bundle);
+
+class SetFrozen final : public score::Command
+{
+  SCORE_COMMAND_DECL(CommandFactoryName(), SetFrozen, "Freeze")
+public:
+  // An empty file unfreezes the process
+  SetFrozen(const Model&, const QString& file);
+
+  void undo(const score::DocumentContext& ctx) const override;
+  void redo(const score::DocumentContext& ctx) const override;
+
+protected:
+  void serializeImpl(DataStreamInput& s) const override;
+  void deserializeImpl(DataStreamOutput& s) override;
+
+private:
+  Path<Model> m_model;
+  QString m_old, m_new;
+};
+
+class SnapRegion final : public score::AggregateCommand
+{
+  SCORE_COMMAND_DECL(
+      CommandFactoryName(),
+      SnapRegion,
+      "Snap region to zero crossings")
 };
 
 }
@@ -6,6 +6,7 @@
 namespace Samplette
 {
 class Model;
+struct voice_resources_set;
 class ProcessExecutorComponent final
     : public Execution::
           ProcessComponent_T<Samplette::Model, ossia::node_process>
@@ -16,6 +17,19 @@ public:
       Model& element,
       const Execution::Context& ctx,
       QObject* parent);
+
+  void cleanup() override;
+
+private:
+  // Prepares the sound of the model and its store on the global thread
+  // pool, then gives them to the node with the analysis
+  void prepareSound();
+
+  int m_soundRequest{};
+  bool m_preparingSound{};
+  // Voice engines of the last sound given to the node, reused by the next
+  // ones when they fit
+  std::shared_ptr<voice_resources_set> m_voiceResources;
 };
 
 using ProcessExecutorComponentFactory
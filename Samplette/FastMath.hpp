@@ -0,0 +1,74 @@
+#pragma once
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
+
+namespace Samplette
+{
+// 2^x for x in [-126; 127], with a relative error under 5e-6
+// (less than a hundredth of a cent when used for pitch ratios).
+[[nodiscard]] inline float fast_exp2(float x) noexcept
+{
+  const float fl = std::floor(x);
+  const float f = x - fl;
+
+  // Least-squares fit of 2^f on [0; 1]
+  const float p
+      = 1.f
+        + f
+              * (0.69301856f
+                 + f * (0.24140525f + f * (0.05207297f + f * 0.01349405f)));
+
+  const int32_t e = static_cast<int32_t>(fl) + 127;
+  return p * std::bit_cast<float>(e << 23);
+}
+
+// Frequency ratio of an interval in cents
+[[nodiscard]] inline float cents_to_ratio(float cents) noexcept
+{
+  return fast_exp2(cents * (1.f / 1200.f));
+}
+
+// Flushes denormal results to zero and reads denormal inputs as zero for
+// its scope: decaying tails and filter states otherwise end up in
+// denormals, which are much slower to compute with.
+class scoped_flush_denormals
+{
+public:
+  scoped_flush_denormals() noexcept
+  {
+#if defined(__SSE2__)
+    // FTZ is bit 15 of MXCSR, DAZ bit 6
+    m_state = _mm_getcsr();
+    _mm_setcsr(m_state | 0x8040);
+#elif defined(__aarch64__)
+    // FZ is bit 24 of FPCR, and covers both on ARM
+    asm volatile("mrs %0, fpcr" : "=r"(m_state));
+    asm volatile("msr fpcr, %0" : : "r"(m_state | (uint64_t(1) << 24)));
+#endif
+  }
+
+  ~scoped_flush_denormals()
+  {
+#if defined(__SSE2__)
+    _mm_setcsr(m_state);
+#elif defined(__aarch64__)
+    asm volatile("msr fpcr, %0" : : "r"(m_state));
+#endif
+  }
+
+  scoped_flush_denormals(const scoped_flush_denormals&) = delete;
+  scoped_flush_denormals& operator=(const scoped_flush_denormals&) = delete;
+
+private:
+#if defined(__SSE2__)
+  unsigned int m_state{};
+#else
+  uint64_t m_state{};
+#endif
+};
+}
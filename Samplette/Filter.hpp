@@ -0,0 +1,77 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+namespace Samplette
+{
+// Topology-preserving state variable filter, after Andrew Simper's
+// "Linear trapezoidal integrated state variable filter" (Cytomic, 2013).
+enum class filter_mode
+{
+  Off,
+  LowPass,
+  HighPass,
+  BandPass
+};
+
+struct svf_coefficients
+{
+  float k{2.f};
+  float a1{1.f};
+  float a2{};
+  float a3{};
+
+  // resonance in [0; 1]
+  static svf_coefficients
+  make(double cutoff, double resonance, double sample_rate) noexcept
+  {
+    cutoff = std::clamp(cutoff, 10., 0.49 * sample_rate);
+    const double g = std::tan(std::numbers::pi * cutoff / sample_rate);
+    const double k = 2. - 1.98 * std::clamp(resonance, 0., 1.);
+    const double a1 = 1. / (1. + g * (g + k));
+    const double a2 = g * a1;
+    return {float(k), float(a1), float(a2), float(g * a2)};
+  }
+};
+
+// Filters one channel of `count` voices at once.
+// x is laid out as [frame][voice] with a stride of `stride` floats, and
+// is filtered in place; the coefficients and states are indexed by voice.
+// The inner loop goes across voices and has no dependency between its
+// iterations, so that it is vectorized.
+template <filter_mode Mode>
+void svf_process(
+    float* x,
+    int frames,
+    int count,
+    int stride,
+    const float* k,
+    const float* a1,
+    const float* a2,
+    const float* a3,
+    float* ic1,
+    float* ic2) noexcept
+{
+  for (int j = 0; j < frames; j++)
+  {
+    float* frame = x + j * stride;
+    for (int i = 0; i < count; i++)
+    {
+      const float v0 = frame[i];
+      const float v3 = v0 - ic2[i];
+      const float v1 = a1[i] * ic1[i] + a2[i] * v3;
+      const float v2 = ic2[i] + a2[i] * ic1[i] + a3[i] * v3;
+      ic1[i] = 2.f * v1 - ic1[i];
+      ic2[i] = 2.f * v2 - ic2[i];
+
+      if constexpr (Mode == filter_mode::LowPass)
+        frame[i] = v2;
+      else if constexpr (Mode == filter_mode::BandPass)
+        frame[i] = v1;
+      else if constexpr (Mode == filter_mode::HighPass)
+        frame[i] = v0 - k[i] * v1 - v2;
+    }
+  }
+}
+}
@@ -0,0 +1,294 @@
+#include "Freeze.hpp"
+
+#include <Samplette/Node.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+namespace Samplette
+{
+ossia::audio_handle render_offline(const render_job& job, render_stats* stats)
+{
+  auto res = std::make_shared<ossia::audio_data>();
+  const auto& midi = job.midi;
+  if ((!job.sound && !job.store) || job.channels <= 0 || midi.sample_rate <= 0.
+      || midi.buffer_size <= 0)
+    return res;
+
+  auto n = std::make_unique<node>();
+  auto& inputs = n->root_inputs();
+
+  // Value of the control of an inlet in the job
+  const auto control = [&](const ossia::inlet& inlet)
+  {
+    const auto it = std::find(inputs.begin(), inputs.end(), &inlet);
+    const std::size_t k = it - inputs.begin() - 1;
+    return k < job.controls.size() ? job.controls[k] : ossia::value{};
+  };
+
+  // Nothing runs concurrently here: the sound is prepared in place
+  node::prewarm_settings settings;
+  settings.start = ossia::convert<float>(control(n->start)) / 100.;
+  settings.length = ossia::convert<float>(control(n->length)) / 100.;
+  settings.loop_start = ossia::convert<float>(control(n->loop_start)) / 100.;
+  settings.direction = play_direction_from_string(
+      ossia::convert<std::string>(control(n->direction)));
+  settings.key_map
+      = parse_multisample(ossia::convert<std::string>(control(n->key_map)));
+  settings.sync = ossia::convert<bool>(control(n->sync));
+  n->set_sound(
+      node::prepare_sound(job.sound, job.store, job.sound_rate, settings));
+  n->set_analysis(job.analysis);
+
+  // The model and the samples are both in samples
+  ossia::execution_state state;
+  state.sampleRate = midi.sample_rate;
+  state.bufferSize = midi.buffer_size;
+  state.modelToSamplesRatio = 1.;
+  state.samplesToModelRatio = 1.;
+  const ossia::exec_state_facade facade{&state};
+
+  // The controls reach the node as if they came from its inlets
+  const auto write_controls = [&](bool clear)
+  {
+    for (std::size_t i = 0; i < job.controls.size(); i++)
+    {
+      if (i + 1 >= inputs.size())
+        break;
+      if (auto port = inputs[i + 1]->target<ossia::value_port>())
+      {
+        if (clear)
+          port->get_data().clear();
+        else
+          port->write_value(job.controls[i], 0);
+      }
+    }
+  };
+  write_controls(false);
+
+  const int64_t bs = midi.buffer_size;
+  const int64_t last_event
+      = midi.events.empty() ? 0 : midi.events.back().date;
+  const int64_t end = last_event + job.max_tail * midi.sample_rate;
+
+  n->out->set_channels(job.channels);
+  std::size_t event = 0;
+  for (int64_t date = 0; date < end; date += bs)
+  {
+    const int64_t frames = std::min(bs, end - date);
+    while (event < midi.events.size()
+           && midi.events[event].date < date + frames)
+    {
+      const auto& e = midi.events[event++];
+      libremidi::message m;
+      m.bytes.assign(e.bytes, e.bytes + e.size);
+      m.timestamp = std::max<int64_t>(e.date - date, 0);
+      n->in->messages.push_back(std::move(m));
+    }
+
+    for (int b = 0; b < max_buses; b++)
+      for (auto& c : n->bus_port(b).get())
+        c.assign(bs, 0.);
+
+    ossia::token_request tk{};
+    tk.prev_date = ossia::time_value{date};
+    tk.date = ossia::time_value{date + frames};
+    const auto t0 = std::chrono::steady_clock::now();
+    n->run(tk, facade);
+    if (stats)
+      stats->seconds += std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - t0)
+                            .count();
+
+    n->in->messages.clear();
+    if (date == 0)
+      write_controls(true);
+
+    // The node sets the number of output channels, e.g. from its layout.
+    // The buses are mixed together, as the frozen render is played on the
+    // main output.
+    std::size_t channels = res->data.size();
+    for (int b = 0; b < max_buses; b++)
+      channels = std::max(channels, n->bus_port(b).get().size());
+    res->data.resize(channels);
+    for (auto& dst : res->data)
+      dst.resize(date + frames);
+
+    for (int b = 0; b < max_buses; b++)
+    {
+      const auto& bus = n->bus_port(b).get();
+      for (std::size_t c = 0; c < bus.size(); c++)
+        for (int64_t j = 0; j < frames; j++)
+          res->data[c][date + j] += bus[c][j];
+    }
+
+    if (date + frames > last_event && !n->sounding())
+      break;
+  }
+
+  if (stats)
+  {
+    stats->time_to_first_sample = n->m_timeToFirstSample;
+    stats->latency = n->latency();
+  }
+  return res;
+}
+
+namespace
+{
+template <typename T>
+void write_le(std::ostream& s, T v)
+{
+  s.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template <typename T>
+bool read_le(std::istream& s, T& v)
+{
+  return bool(s.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+
+constexpr uint16_t wave_format_pcm = 1;
+constexpr uint16_t wave_format_ieee_float = 3;
+constexpr uint16_t wave_format_extensible = 0xFFFE;
+
+// Converts one little-endian sample to float
+float wav_sample(const unsigned char* p, uint16_t format, uint16_t bits)
+{
+  if (format == wave_format_ieee_float)
+  {
+    float f;
+    std::memcpy(&f, p, sizeof(f));
+    return f;
+  }
+
+  // Integer samples are put in the high bits of an int32 to sign-extend
+  uint32_t v = 0;
+  const int bytes = bits / 8;
+  for (int b = 0; b < bytes; b++)
+    v |= uint32_t(p[b]) << (8 * (4 - bytes + b));
+  if (bits == 8)
+    v ^= 0x80000000u; // 8-bit WAV is unsigned
+  return int32_t(v) * (1.f / 2147483648.f);
+}
+}
+
+bool write_wav(
+    const std::string& path,
+    const ossia::audio_data& audio,
+    int sample_rate)
+{
+  std::ofstream f{path, std::ios::binary};
+  if (!f)
+    return false;
+
+  const uint16_t channels = audio.data.size();
+  const uint32_t frames = channels > 0 ? audio.data[0].size() : 0;
+  const uint32_t data_size = frames * channels * sizeof(float);
+
+  f.write("RIFF", 4);
+  write_le<uint32_t>(f, 36 + data_size);
+  f.write("WAVE", 4);
+
+  f.write("fmt ", 4);
+  write_le<uint32_t>(f, 16);
+  write_le<uint16_t>(f, wave_format_ieee_float);
+  write_le<uint16_t>(f, channels);
+  write_le<uint32_t>(f, sample_rate);
+  write_le<uint32_t>(f, sample_rate * channels * sizeof(float));
+  write_le<uint16_t>(f, channels * sizeof(float));
+  write_le<uint16_t>(f, 32);
+
+  f.write("data", 4);
+  write_le<uint32_t>(f, data_size);
+
+  std::vector<float> interleaved(std::size_t(frames) * channels);
+  for (uint16_t c = 0; c < channels; c++)
+    for (uint32_t j = 0; j < frames; j++)
+      interleaved[j * channels + c] = audio.data[c][j];
+  f.write(
+      reinterpret_cast<const char*>(interleaved.data()),
+      interleaved.size() * sizeof(float));
+  return bool(f);
+}
+
+ossia::audio_handle read_wav(const std::string& path, int& sample_rate)
+{
+  std::ifstream f{path, std::ios::binary};
+  char tag[4];
+  uint32_t size{};
+  if (!f.read(tag, 4) || std::memcmp(tag, "RIFF", 4) != 0)
+    return {};
+  if (!read_le(f, size) || !f.read(tag, 4) || std::memcmp(tag, "WAVE", 4))
+    return {};
+
+  uint16_t format{}, channels{}, bits{};
+  uint32_t rate{};
+  while (f.read(tag, 4) && read_le(f, size))
+  {
+    if (std::memcmp(tag, "fmt ", 4) == 0)
+    {
+      uint32_t byte_rate{};
+      uint16_t align{};
+      read_le(f, format);
+      read_le(f, channels);
+      read_le(f, rate);
+      read_le(f, byte_rate);
+      read_le(f, align);
+      read_le(f, bits);
+      if (format == wave_format_extensible && size >= 26)
+      {
+        // The actual format is at the start of the sub-format GUID
+        uint16_t cb_size{}, valid_bits{};
+        uint32_t channel_mask{};
+        read_le(f, cb_size);
+        read_le(f, valid_bits);
+        read_le(f, channel_mask);
+        read_le(f, format);
+        f.seekg(size - 26, std::ios::cur);
+      }
+      else
+      {
+        f.seekg(size - 16, std::ios::cur);
+      }
+    }
+    else if (std::memcmp(tag, "data", 4) == 0)
+    {
+      const bool supported
+          = (format == wave_format_ieee_float && bits == 32)
+            || (format == wave_format_pcm
+                && (bits == 8 || bits == 16 || bits == 24 || bits == 32));
+      if (!supported || channels == 0)
+        return {};
+
+      const std::size_t stride = channels * (bits / 8);
+      const std::size_t frames = size / stride;
+      std::vector<unsigned char> interleaved(frames * stride);
+      if (!f.read(
+              reinterpret_cast<char*>(interleaved.data()),
+              interleaved.size()))
+        return {};
+
+      auto res = std::make_shared<ossia::audio_data>();
+      res->data.resize(channels);
+      for (uint16_t c = 0; c < channels; c++)
+      {
+        res->data[c].resize(frames);
+        for (std::size_t j = 0; j < frames; j++)
+          res->data[c][j] = wav_sample(
+              interleaved.data() + j * stride + c * (bits / 8), format, bits);
+      }
+      res->path = path;
+      sample_rate = rate;
+      return res;
+    }
+    else
+    {
+      f.seekg(size + (size & 1), std::ios::cur);
+    }
+  }
+  return {};
+}
+}
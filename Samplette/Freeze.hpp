@@ -0,0 +1,83 @@
+#pragma once
+#include <ossia/dataflow/nodes/sound_ref.hpp>
+#include <ossia/network/value/value.hpp>
+
+#include <Samplette/Analysis.hpp>
+#include <Samplette/SampleStore.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Samplette
+{
+// A MIDI message received by the node, dated in samples from the start of
+// its process.
+struct midi_event
+{
+  int64_t date{};
+  uint8_t bytes[3]{};
+  uint8_t size{};
+};
+
+// The MIDI received during the last playback, with the settings of the
+// audio engine at that time.
+struct midi_capture
+{
+  std::vector<midi_event> events;
+  double sample_rate{};
+  int buffer_size{};
+};
+
+// The capture of a node, handed over by the audio thread to a thread
+// which waits for `done`
+struct capture_handoff
+{
+  midi_capture capture;
+  std::atomic_bool done{};
+};
+
+// Everything needed to render the node without the execution engine.
+// The control values are in the order of the node inlets.
+struct render_job
+{
+  // Null when the sound is only kept compressed, see Model::sound
+  ossia::audio_handle sound;
+  int channels{};
+  int sound_rate{};
+  // Optional, used for snapping and compressed storage
+  std::shared_ptr<const sample_analysis> analysis;
+  std::shared_ptr<const sample_store> store;
+  std::vector<ossia::value> controls;
+  midi_capture midi;
+
+  // Rendering stops once all the voices are done after the last event,
+  // or at the latest this many seconds after it.
+  double max_tail{30.};
+};
+
+struct render_stats
+{
+  // Wall-clock time spent in the node, in seconds
+  double seconds{};
+  // See node::m_timeToFirstSample
+  int64_t time_to_first_sample{-1};
+  // Frames of delay added by the limiter, see node::latency
+  int64_t latency{};
+};
+
+// Renders the node block by block, as fast as possible. The result only
+// depends on the job: renders of the same job are identical.
+[[nodiscard]] ossia::audio_handle
+render_offline(const render_job& job, render_stats* stats = nullptr);
+
+// WAV files: the renders are written as 32-bit float, and 8 to 32-bit
+// PCM or float files can be read back.
+bool write_wav(
+    const std::string& path,
+    const ossia::audio_data& audio,
+    int sample_rate);
+[[nodiscard]] ossia::audio_handle
+read_wav(const std::string& path, int& sample_rate);
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <string>
+
+namespace Samplette
+{
+static constexpr const int max_grains{1024};
+static constexpr const int grain_chunk{256};
+
+enum class grain_window : uint8_t
+{
+  Hann,
+  Triangle,
+  Tukey,
+  Gaussian
+};
+static constexpr const int grain_window_count{4};
+
+[[nodiscard]] inline grain_window
+grain_window_from_string(const std::string& str) noexcept
+{
+  if (str == "Triangle")
+    return grain_window::Triangle;
+  else if (str == "Tukey")
+    return grain_window::Tukey;
+  else if (str == "Gaussian")
+    return grain_window::Gaussian;
+  return grain_window::Hann;
+}
+
+// The window shapes are sampled once: grains read them with linear
+// interpolation instead of computing a cosine or an exponential per frame.
+class grain_windows
+{
+public:
+  static constexpr const int size{1024};
+
+  grain_windows()
+  {
+    using std::numbers::pi;
+    // Edge of the gaussian, removed so that it starts and ends at zero
+    const double sigma = 0.15;
+    const double edge = std::exp(-0.5 * (0.5 / sigma) * (0.5 / sigma));
+    for (int k = 0; k <= size; k++)
+    {
+      const double x = double(k) / size;
+      const double g = (x - 0.5) / sigma;
+      // Tukey: cosine tapers over the first and last quarters
+      const double t = std::min(x, 1. - x) * 4.;
+
+      m_tables[int(grain_window::Hann)][k] = 0.5 - 0.5 * std::cos(2. * pi * x);
+      m_tables[int(grain_window::Triangle)][k] = 1. - std::abs(2. * x - 1.);
+      m_tables[int(grain_window::Tukey)][k]
+          = t < 1. ? 0.5 - 0.5 * std::cos(pi * t) : 1.;
+      m_tables[int(grain_window::Gaussian)][k]
+          = std::max(0., (std::exp(-0.5 * g * g) - edge) / (1. - edge));
+    }
+
+    // Rounding can bring the phase of the last frame of a grain to 1
+    for (auto& t : m_tables)
+      t[size + 1] = 0.f;
+  }
+
+  const float* table(grain_window w) const noexcept
+  {
+    return m_tables[int(w)].data();
+  }
+
+private:
+  std::array<std::array<float, size + 2>, grain_window_count> m_tables{};
+};
+
+// Grains of all the voices, stored as structure-of-arrays like the voices.
+// The pool is allocated with the node: when it is full, new grains are
+// skipped.
+struct grain_pool
+{
+  int count{};
+
+  // Engine slot of the voice the grain belongs to, and the sound it reads
+  std::array<int16_t, max_grains> slot{};
+  std::array<int8_t, max_grains> sound{};
+
+  // Frame in the sound and advance per output frame
+  std::array<double, max_grains> position{};
+  std::array<double, max_grains> step{};
+
+  // Window phase in [0; 1) and its advance per output frame
+  std::array<float, max_grains> phase{};
+  std::array<float, max_grains> phase_step{};
+  std::array<grain_window, max_grains> window{};
+  std::array<float, max_grains> gain{};
+
+  // Frames before the grain starts in the current block, and frames left
+  std::array<int32_t, max_grains> delay{};
+  std::array<int32_t, max_grains> remaining{};
+
+  // Returns the index of the new grain, or -1 when the pool is full
+  int add() noexcept { return count < max_grains ? count++ : -1; }
+
+  // Moves the last grain in place of grain i
+  void remove(int i) noexcept
+  {
+    const int last = --count;
+    if (i == last)
+      return;
+
+    slot[i] = slot[last];
+    sound[i] = sound[last];
+    position[i] = position[last];
+    step[i] = step[last];
+    phase[i] = phase[last];
+    phase_step[i] = phase_step[last];
+    window[i] = window[last];
+    gain[i] = gain[last];
+    delay[i] = delay[last];
+    remaining[i] = remaining[last];
+  }
+
+  // Stops the grains of a voice
+  void remove_slot(int s) noexcept
+  {
+    for (int i = count - 1; i >= 0; i--)
+      if (slot[i] == s)
+        remove(i);
+  }
+};
+
+// Adds `frames` frames of a grain to `out`. The sample and the window are
+// both read with linear interpolation; the window gain of a chunk is
+// computed first so that the loops have no branch and are vectorized.
+// The caller makes sure that the grain does not read past the data.
+inline void mix_grain(
+    const float* const* in,
+    std::size_t channels,
+    double position,
+    double step,
+    const float* window,
+    float phase,
+    float phase_step,
+    float gain,
+    double* const* out,
+    int64_t frames) noexcept
+{
+  std::array<float, grain_chunk> w;
+  for (int64_t j0 = 0; j0 < frames; j0 += grain_chunk)
+  {
+    const int n = std::min<int64_t>(grain_chunk, frames - j0);
+    for (int j = 0; j < n; j++)
+    {
+      const float p = (phase + (j0 + j) * phase_step) * grain_windows::size;
+      const int idx = p;
+      const float frac = p - idx;
+      w[j] = gain * (window[idx] + frac * (window[idx + 1] - window[idx]));
+    }
+
+    for (std::size_t c = 0; c < channels; c++)
+    {
+      const float* x = in[c];
+      double* o = out[c] + j0;
+      for (int j = 0; j < n; j++)
+      {
+        const double p = position + (j0 + j) * step;
+        const int64_t idx = p;
+        const double frac = p - idx;
+        o[j] += (x[idx] + frac * (x[idx + 1] - x[idx])) * w[j];
+      }
+    }
+  }
+}
+}
@@ -1,9 +1,17 @@
 #include "Inspector.hpp"
 
+#include <Process/Commands/SetControlValue.hpp>
+
+#include <score/command/Dispatchers/MacroCommandDispatcher.hpp>
 #include <score/document/DocumentContext.hpp>
 
+#include <Samplette/CommandFactory.hpp>
+
+#include <QDebug>
+#include <QFileDialog>
 #include <QFormLayout>
 #include <QLabel>
+#include <QPushButton>
 
 namespace Samplette
 {
@@ -12,11 +20,174 @@ InspectorWidget::InspectorWidget(
     const score::DocumentContext& context,
     QWidget* parent)
     : InspectorWidgetDelegate_T{object, parent}
-    , m_dispatcher{context.commandStack}
+    , m_context{context}
+    , m_zeroCrossings{new QLabel{this}}
+    , m_loopPoints{new QLabel{this}}
+    , m_snap{new QPushButton{tr("Snap region"), this}}
+    , m_capture{new QLabel{this}}
+    , m_freeze{new QPushButton{this}}
+    , m_saveKit{new QPushButton{tr("Save kit..."), this}}
+    , m_loadKit{new QPushButton{tr("Load kit..."), this}}
+    , m_latency{new QLabel{this}}
 {
   auto lay = new QFormLayout{this};
-  lay->addWidget(new QLabel("change me"));
+  lay->addRow(tr("Zero crossings"), m_zeroCrossings);
+  lay->addRow(tr("Loop points"), m_loopPoints);
+  lay->addRow(m_snap);
+  lay->addRow(tr("Captured MIDI"), m_capture);
+  lay->addRow(m_freeze);
+  lay->addRow(m_saveKit);
+  lay->addRow(m_loadKit);
+  lay->addRow(tr("Latency"), m_latency);
+
+  connect(m_snap, &QPushButton::clicked, this, &InspectorWidget::snapRegion);
+  connect(
+      m_freeze, &QPushButton::clicked, this, &InspectorWidget::toggleFreeze);
+  connect(m_saveKit, &QPushButton::clicked, this, &InspectorWidget::saveKit);
+  connect(m_loadKit, &QPushButton::clicked, this, &InspectorWidget::loadKit);
+  connect(
+      &object,
+      &Model::analysisChanged,
+      this,
+      &InspectorWidget::updateAnalysis);
+  connect(
+      &object, &Model::frozenChanged, this, &InspectorWidget::updateFreeze);
+  connect(
+      &object,
+      &Model::capturedMidiChanged,
+      this,
+      &InspectorWidget::updateFreeze);
+  connect(
+      &object, &Model::freezingChanged, this, &InspectorWidget::updateFreeze);
+  for (auto ctl : {object.limiter.get(), object.lookahead.get()})
+    connect(
+        ctl,
+        &Process::ControlInlet::valueChanged,
+        this,
+        &InspectorWidget::updateLatency);
+  updateAnalysis();
+  updateFreeze();
+  updateLatency();
 }
 
 InspectorWidget::~InspectorWidget() { }
+
+void InspectorWidget::updateAnalysis()
+{
+  if (auto& a = process().analysis())
+  {
+    m_zeroCrossings->setText(QString::number(a->zero_crossings.size()));
+    m_loopPoints->setText(QString::number(a->loop_points.size()));
+    m_snap->setEnabled(true);
+  }
+  else
+  {
+    m_zeroCrossings->setText(tr("Analysing..."));
+    m_loopPoints->setText(tr("Analysing..."));
+    m_snap->setEnabled(false);
+  }
+}
+
+void InspectorWidget::updateFreeze()
+{
+  auto& proc = process();
+  const auto events = proc.capturedMidi().events.size();
+  m_capture->setText(
+      events > 0 ? tr("%1 events").arg(events) : tr("Play to capture"));
+
+  if (proc.freezing())
+  {
+    m_freeze->setText(tr("Freezing..."));
+    m_freeze->setEnabled(false);
+  }
+  else if (!proc.frozenFile().isEmpty())
+  {
+    m_freeze->setText(tr("Unfreeze"));
+    m_freeze->setEnabled(true);
+  }
+  else
+  {
+    m_freeze->setText(tr("Freeze"));
+    m_freeze->setEnabled(events > 0);
+  }
+}
+
+void InspectorWidget::updateLatency()
+{
+  const double ms = process().latency() * 1000.;
+  m_latency->setText(ms > 0. ? tr("%1 ms").arg(ms, 0, 'f', 1) : tr("None"));
+}
+
+void InspectorWidget::toggleFreeze()
+{
+  auto& proc = process();
+  if (!proc.frozenFile().isEmpty())
+  {
+    CommandDispatcher<>{m_context.commandStack}.submit<SetFrozen>(
+        proc, QString{});
+  }
+  else
+  {
+    const_cast<Model&>(proc).freeze();
+  }
+}
+
+void InspectorWidget::snapRegion()
+{
+  auto& proc = process();
+  auto& a = proc.analysis();
+  if (!a || a->frames <= 0)
+    return;
+
+  const auto percent = [](const Process::ControlInlet& ctl)
+  { return ossia::convert<float>(ctl.value()) / 100.; };
+
+  const auto region = make_region(
+      a->frames,
+      percent(*proc.start),
+      percent(*proc.length),
+      percent(*proc.loop_start),
+      a.get());
+
+  // Back to the percentages used by the controls
+  const double rest = a->frames - region.start;
+  RedoMacroCommandDispatcher<SnapRegion> disp{m_context.commandStack};
+  disp.submit(new Process::SetControlValue{
+      *proc.start, float(100. * region.start / a->frames)});
+  disp.submit(new Process::SetControlValue{
+      *proc.length, float(100. * region.length / rest)});
+  disp.submit(new Process::SetControlValue{
+      *proc.loop_start, float(100. * region.loop_start / rest)});
+  disp.commit();
+}
+
+void InspectorWidget::saveKit()
+{
+  auto& proc = process();
+  if (!proc.sound() && !proc.store())
+    return;
+
+  const auto filter = tr("Samplette kits (*.%1)").arg(kit_extension);
+  auto file = QFileDialog::getSaveFileName(
+      this, tr("Save kit"), QString{}, filter);
+  if (file.isEmpty())
+    return;
+  if (!file.endsWith(QStringLiteral(".") + kit_extension))
+    file += QStringLiteral(".") + kit_extension;
+
+  if (!const_cast<Model&>(proc).saveKit(file))
+    qWarning() << "Samplette: could not save kit" << file;
+}
+
+void InspectorWidget::loadKit()
+{
+  const auto filter = tr("Samplette kits (*.%1)").arg(kit_extension);
+  const auto file = QFileDialog::getOpenFileName(
+      this, tr("Load kit"), QString{}, filter);
+  if (file.isEmpty())
+    return;
+
+  if (!Samplette::loadKit(m_context, process(), file))
+    qWarning() << "Samplette: could not load kit" << file;
+}
 }
@@ -6,6 +6,8 @@
 
 #include <Samplette/Process.hpp>
 
+class QLabel;
+class QPushButton;
 namespace Samplette
 {
 class InspectorWidget final
@@ -19,7 +21,23 @@ public:
   ~InspectorWidget() override;
 
 private:
-  CommandDispatcher<> m_dispatcher;
+  void updateAnalysis();
+  void updateFreeze();
+  void updateLatency();
+  void snapRegion();
+  void toggleFreeze();
+  void saveKit();
+  void loadKit();
+
+  const score::DocumentContext& m_context;
+  QLabel* m_zeroCrossings{};
+  QLabel* m_loopPoints{};
+  QPushButton* m_snap{};
+  QLabel* m_capture{};
+  QPushButton* m_freeze{};
+  QPushButton* m_saveKit{};
+  QPushButton* m_loadKit{};
+  QLabel* m_latency{};
 };
 
 class InspectorFactory final
@@ -0,0 +1,157 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace Samplette
+{
+// Inner loops of the voices, compiled for the common cases: mono or
+// stereo, forward or reversed, at the pitch of the sample or not, and
+// with a constant or a moving gain. The variant is picked once per voice
+// and per block from a table, so that the loops themselves do not branch.
+
+inline const float* channel_data(const float* data) noexcept
+{
+  return data;
+}
+
+inline const float* channel_data(float* data) noexcept
+{
+  return data;
+}
+
+template <typename Channel>
+const float* channel_data(const Channel& data) noexcept
+{
+  return data.data();
+}
+
+// Linear interpolation of `frames` frames which do not cross the region
+// end, written from out[c][offset]. Frame k of the playback is at
+// data[c][first + k * Dir].
+// Channels is 0 for any channel count: mono and stereo share the index
+// computation between their channels. At a ratio of 1 the fraction is
+// the same for all the frames and the reads are contiguous.
+template <typename Data, int Channels, int Dir, bool Unit>
+void interpolate(
+    const Data& data,
+    std::size_t channels,
+    int64_t first,
+    double position,
+    double ratio,
+    double* const* out,
+    int64_t offset,
+    int64_t frames) noexcept
+{
+  if constexpr (Unit)
+  {
+    const int64_t base = position;
+    const double frac = position - base;
+    for (std::size_t c = 0; c < channels; c++)
+    {
+      const float* in = channel_data(data[c]) + first + base * Dir;
+      double* o = out[c] + offset;
+      for (int64_t j = 0; j < frames; j++)
+      {
+        const float a = in[j * Dir];
+        o[j] = a + frac * (in[(j + 1) * Dir] - a);
+      }
+    }
+  }
+  else if constexpr (Channels == 0)
+  {
+    for (std::size_t c = 0; c < channels; c++)
+    {
+      const float* in = channel_data(data[c]) + first;
+      double* o = out[c] + offset;
+      for (int64_t j = 0; j < frames; j++)
+      {
+        const double p = position + j * ratio;
+        const int64_t idx = p;
+        const double frac = p - idx;
+        const float a = in[idx * Dir];
+        o[j] = a + frac * (in[(idx + 1) * Dir] - a);
+      }
+    }
+  }
+  else
+  {
+    const float* in[Channels];
+    double* o[Channels];
+    for (int c = 0; c < Channels; c++)
+    {
+      in[c] = channel_data(data[c]) + first;
+      o[c] = out[c] + offset;
+    }
+    for (int64_t j = 0; j < frames; j++)
+    {
+      const double p = position + j * ratio;
+      const int64_t idx = p;
+      const double frac = p - idx;
+      for (int c = 0; c < Channels; c++)
+      {
+        const float a = in[c][idx * Dir];
+        o[c][j] = a + frac * (in[c][(idx + 1) * Dir] - a);
+      }
+    }
+  }
+}
+
+template <typename Data>
+using interpolate_kernel = void (*)(
+    const Data&,
+    std::size_t,
+    int64_t,
+    double,
+    double,
+    double* const*,
+    int64_t,
+    int64_t) noexcept;
+
+// Indexed by channels (mono, stereo, any), direction and unit ratio
+template <typename Data>
+inline constexpr interpolate_kernel<Data> interpolate_kernels[3][2][2]{
+    {{&interpolate<Data, 1, 1, false>, &interpolate<Data, 1, 1, true>},
+     {&interpolate<Data, 1, -1, false>, &interpolate<Data, 1, -1, true>}},
+    {{&interpolate<Data, 2, 1, false>, &interpolate<Data, 2, 1, true>},
+     {&interpolate<Data, 2, -1, false>, &interpolate<Data, 2, -1, true>}},
+    {{&interpolate<Data, 0, 1, false>, &interpolate<Data, 0, 1, true>},
+     {&interpolate<Data, 0, -1, false>, &interpolate<Data, 0, -1, true>}}};
+
+template <typename Data>
+interpolate_kernel<Data>
+select_interpolate(std::size_t channels, bool reverse, double ratio) noexcept
+{
+  const int layout = channels == 1 ? 0 : channels == 2 ? 1 : 2;
+  return interpolate_kernels<Data>[layout][reverse][ratio == 1.];
+}
+
+// Adds a voice channel to an output with its gain curve, or with a
+// constant gain when the envelope holds still during the block, e.g. for
+// sustained notes. `gain` scales the curve, e.g. for panning.
+template <bool Constant>
+void mix_channel(
+    const double* in,
+    const float* env,
+    float gain,
+    double* out,
+    int64_t frames) noexcept
+{
+  if constexpr (Constant)
+  {
+    for (int64_t j = 0; j < frames; j++)
+      out[j] += in[j] * gain;
+  }
+  else
+  {
+    for (int64_t j = 0; j < frames; j++)
+      out[j] += in[j] * (env[j] * gain);
+  }
+}
+
+using mix_kernel
+    = void (*)(const double*, const float*, float, double*, int64_t) noexcept;
+
+inline constexpr mix_kernel mix_kernels[2]{
+    &mix_channel<false>,
+    &mix_channel<true>};
+}
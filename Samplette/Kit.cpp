@@ -0,0 +1,448 @@
+#include "Kit.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if __has_include(<sys/mman.h>) && __has_include(<unistd.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SAMPLETTE_HAS_MMAP 1
+#endif
+
+namespace Samplette
+{
+namespace
+{
+// Layout of the file, all integers are little-endian:
+//
+//   header      see kit_header
+//   metadata    u32 control count, then for each control a string name,
+//               a u8 type tag and the value; then the sample name.
+//               Strings are a u32 size followed by the bytes.
+//   samples     float32 frames of each channel, each channel starting on
+//               a page boundary
+//   store       bytes of each channel of the compressed copy, one after
+//               the other, each starting on a page boundary. Packed
+//               channels have their own size, see packed_channel_bytes.
+//
+// Since version 2, either of samples and store may be left out, with an
+// offset of 0, but not both.
+constexpr char kit_magic[8]{'S', 'M', 'P', 'L', 'K', 'I', 'T', '\0'};
+constexpr uint32_t kit_version{2};
+constexpr uint64_t kit_alignment{4096};
+constexpr uint32_t max_kit_channels{64};
+
+struct kit_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t channels;
+  uint64_t frames;
+  uint32_t sample_rate;
+  uint32_t store_format;
+  uint64_t metadata_offset;
+  uint64_t metadata_size;
+  uint64_t samples_offset;
+  uint64_t store_offset;
+};
+static_assert(sizeof(kit_header) == 64);
+
+enum value_tag : uint8_t
+{
+  tag_bool,
+  tag_int,
+  tag_float,
+  tag_string
+};
+
+constexpr uint64_t align(uint64_t x) noexcept
+{
+  return (x + kit_alignment - 1) & ~(kit_alignment - 1);
+}
+
+template <typename T>
+void append(std::string& out, T v)
+{
+  out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+void append_string(std::string& out, const std::string& str)
+{
+  append<uint32_t>(out, str.size());
+  out += str;
+}
+
+// Bounds-checked reads in the metadata
+struct byte_reader
+{
+  const uint8_t* data;
+  std::size_t size;
+  std::size_t pos{};
+
+  template <typename T>
+  bool read(T& v) noexcept
+  {
+    if (size - pos < sizeof(T))
+      return false;
+    std::memcpy(&v, data + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+  }
+
+  bool read_string(std::string& str)
+  {
+    uint32_t n{};
+    if (!read(n) || size - pos < n)
+      return false;
+    str.assign(reinterpret_cast<const char*>(data + pos), n);
+    pos += n;
+    return true;
+  }
+};
+
+// Read-only view of a whole file: mapped when the system allows it,
+// read in memory otherwise.
+class mapped_file
+{
+public:
+  explicit mapped_file(const std::string& path)
+  {
+#if defined(SAMPLETTE_HAS_MMAP)
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st = {};
+    if (::fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      void* map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED)
+      {
+        // The channels are copied from start to end
+        ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+        m_map = map;
+        m_data = static_cast<const uint8_t*>(map);
+        m_size = st.st_size;
+      }
+    }
+    ::close(fd);
+    if (m_data)
+      return;
+#endif
+    std::ifstream f{path, std::ios::binary};
+    m_buffer.assign(
+        std::istreambuf_iterator<char>{f}, std::istreambuf_iterator<char>{});
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+  }
+
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  ~mapped_file()
+  {
+#if defined(SAMPLETTE_HAS_MMAP)
+    if (m_map)
+      ::munmap(m_map, m_size);
+#endif
+  }
+
+  const uint8_t* data() const noexcept { return m_data; }
+  std::size_t size() const noexcept { return m_size; }
+
+private:
+  void* m_map{};
+  std::vector<uint8_t> m_buffer;
+  const uint8_t* m_data{};
+  std::size_t m_size{};
+};
+
+// Size of a channel of the store at `data`, or 0 if it does not fit in
+// `size` bytes
+std::size_t store_bytes(
+    sample_format format,
+    const uint8_t* data,
+    uint64_t size,
+    uint64_t frames)
+{
+  uint64_t res = 0;
+  switch (format)
+  {
+    case sample_format::Int16:
+      res = frames * 2;
+      break;
+    case sample_format::Int24:
+      res = frames * 3;
+      break;
+    case sample_format::Packed16:
+      return packed_channel_bytes(data, size, frames);
+    case sample_format::Float32:
+      break;
+  }
+  // Checked on frames first so that the products above do not overflow
+  return frames <= size && res <= size ? res : 0;
+}
+}
+
+bool write_kit(const std::string& path, const kit& kit)
+{
+  const auto& store = kit.store;
+  const bool has_sound = kit.sound && !kit.sound->data.empty();
+  if (!has_sound && !store)
+    return false;
+
+  const std::size_t channels
+      = has_sound ? kit.sound->data.size() : store->size();
+  const uint64_t frames
+      = has_sound ? kit.sound->data[0].size() : store->frames;
+  if (channels == 0 || channels > max_kit_channels)
+    return false;
+
+  std::string metadata;
+  uint32_t count = 0;
+  append<uint32_t>(metadata, 0);
+  for (const auto& [name, value] : kit.controls)
+  {
+    if (auto b = value.target<bool>())
+    {
+      append_string(metadata, name);
+      append<uint8_t>(metadata, tag_bool);
+      append<uint8_t>(metadata, *b);
+    }
+    else if (auto i = value.target<int>())
+    {
+      append_string(metadata, name);
+      append<uint8_t>(metadata, tag_int);
+      append<int32_t>(metadata, *i);
+    }
+    else if (auto f = value.target<float>())
+    {
+      append_string(metadata, name);
+      append<uint8_t>(metadata, tag_float);
+      append<float>(metadata, *f);
+    }
+    else if (auto s = value.target<std::string>())
+    {
+      append_string(metadata, name);
+      append<uint8_t>(metadata, tag_string);
+      append_string(metadata, *s);
+    }
+    else
+    {
+      continue;
+    }
+    count++;
+  }
+  std::memcpy(metadata.data(), &count, sizeof(count));
+  append_string(metadata, kit.sample_name);
+
+  std::vector<uint64_t> store_sizes;
+  if (store && store->size() == channels
+      && uint64_t(store->frames) == frames)
+  {
+    for (const auto& chan : store->data)
+      store_sizes.push_back(
+          store_bytes(store->format, chan.data(), chan.size(), frames));
+  }
+  const bool has_store
+      = !store_sizes.empty()
+        && std::find(store_sizes.begin(), store_sizes.end(), 0)
+               == store_sizes.end();
+  if (!has_sound && !has_store)
+    return false;
+
+  kit_header header{};
+  std::memcpy(header.magic, kit_magic, sizeof(kit_magic));
+  header.version = kit_version;
+  header.channels = channels;
+  header.frames = frames;
+  header.sample_rate = kit.sample_rate;
+  header.store_format = uint32_t(
+      has_store ? store->format : sample_format::Float32);
+  header.metadata_offset = sizeof(kit_header);
+  header.metadata_size = metadata.size();
+  const uint64_t data_offset = align(sizeof(kit_header) + metadata.size());
+  const uint64_t samples_stride = align(frames * sizeof(float));
+  header.samples_offset = has_sound ? data_offset : 0;
+  header.store_offset
+      = !has_store ? 0
+        : has_sound ? data_offset + channels * samples_stride
+                    : data_offset;
+
+  std::ofstream f{path, std::ios::binary | std::ios::trunc};
+  if (!f)
+    return false;
+
+  const auto pad_to = [&f](uint64_t offset)
+  {
+    static const char zeros[kit_alignment]{};
+    for (uint64_t pos = f.tellp(); pos < offset;)
+    {
+      const auto n = std::min<uint64_t>(offset - pos, kit_alignment);
+      f.write(zeros, n);
+      pos += n;
+    }
+  };
+
+  f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  f.write(metadata.data(), metadata.size());
+  for (std::size_t c = 0; has_sound && c < channels; c++)
+  {
+    pad_to(header.samples_offset + c * samples_stride);
+    f.write(
+        reinterpret_cast<const char*>(kit.sound->data[c].data()),
+        frames * sizeof(float));
+  }
+
+  uint64_t pos = header.store_offset;
+  for (std::size_t c = 0; has_store && c < channels; c++)
+  {
+    pad_to(pos);
+    f.write(
+        reinterpret_cast<const char*>(store->data[c].data()),
+        store_sizes[c]);
+    pos = align(pos + store_sizes[c]);
+  }
+  return bool(f);
+}
+
+std::shared_ptr<const kit> read_kit(const std::string& path, bool floats)
+{
+  const mapped_file file{path};
+  const uint8_t* data = file.data();
+  const uint64_t size = file.size();
+
+  kit_header header;
+  if (size < sizeof(header))
+    return {};
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kit_magic, sizeof(kit_magic)) != 0
+      || header.version == 0 || header.version > kit_version
+      || header.channels == 0
+      || header.channels > max_kit_channels || header.sample_rate == 0)
+    return {};
+
+  // Every section must fit in the file
+  const uint64_t samples_stride = align(header.frames * sizeof(float));
+  const auto format = sample_format(header.store_format);
+  if (header.metadata_offset > size
+      || header.metadata_size > size - header.metadata_offset)
+    return {};
+  if (header.samples_offset == 0 && header.store_offset == 0)
+    return {};
+  if (header.samples_offset != 0
+      && (header.frames > size / sizeof(float)
+          || header.samples_offset > size
+          || (header.channels - 1) * samples_stride
+                     + header.frames * sizeof(float)
+                 > size - header.samples_offset))
+    return {};
+
+  // Channels of the store are found one after the other
+  std::vector<std::pair<uint64_t, uint64_t>> store_channels;
+  for (uint64_t pos = header.store_offset;
+       header.store_offset != 0 && store_channels.size() < header.channels;)
+  {
+    const uint64_t n
+        = pos < size
+              ? store_bytes(format, data + pos, size - pos, header.frames)
+              : 0;
+    if (n == 0)
+      return {};
+    store_channels.emplace_back(pos, n);
+    pos = align(pos + n);
+  }
+
+  auto res = std::make_shared<kit>();
+  byte_reader meta{data + header.metadata_offset, header.metadata_size};
+  uint32_t count{};
+  if (!meta.read(count))
+    return {};
+  for (uint32_t i = 0; i < count; i++)
+  {
+    std::string name;
+    uint8_t tag{};
+    if (!meta.read_string(name) || !meta.read(tag))
+      return {};
+
+    switch (tag)
+    {
+      case tag_bool:
+      {
+        uint8_t v{};
+        if (!meta.read(v))
+          return {};
+        res->controls.emplace_back(std::move(name), bool(v));
+        break;
+      }
+      case tag_int:
+      {
+        int32_t v{};
+        if (!meta.read(v))
+          return {};
+        res->controls.emplace_back(std::move(name), int(v));
+        break;
+      }
+      case tag_float:
+      {
+        float v{};
+        if (!meta.read(v))
+          return {};
+        res->controls.emplace_back(std::move(name), v);
+        break;
+      }
+      case tag_string:
+      {
+        std::string v;
+        if (!meta.read_string(v))
+          return {};
+        res->controls.emplace_back(std::move(name), std::move(v));
+        break;
+      }
+      default:
+        return {};
+    }
+  }
+  if (!meta.read_string(res->sample_name))
+    return {};
+
+  res->sample_rate = header.sample_rate;
+
+  if (header.store_offset != 0)
+  {
+    auto store = std::make_shared<sample_store>();
+    store->format = format;
+    store->frames = header.frames;
+    store->data.resize(header.channels);
+    for (uint32_t c = 0; c < header.channels; c++)
+    {
+      const auto [offset, bytes] = store_channels[c];
+      store->data[c].assign(data + offset, data + offset + bytes);
+    }
+    res->store = std::move(store);
+  }
+
+  if (!floats && res->store)
+    return res;
+
+  auto sound = std::make_shared<ossia::audio_data>();
+  sound->data.resize(header.channels);
+  for (uint32_t c = 0; c < header.channels; c++)
+  {
+    auto& chan = sound->data[c];
+    chan.resize(header.frames);
+    if (header.samples_offset != 0)
+      std::memcpy(
+          chan.data(),
+          data + header.samples_offset + c * samples_stride,
+          header.frames * sizeof(float));
+    else
+      res->store->decode(c, 0, header.frames, chan.data());
+  }
+  sound->path = path;
+  res->sound = std::move(sound);
+  return res;
+}
+}
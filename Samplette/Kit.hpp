@@ -0,0 +1,46 @@
+#pragma once
+#include <ossia/dataflow/nodes/sound_ref.hpp>
+#include <ossia/network/value/value.hpp>
+
+#include <Samplette/SampleStore.hpp>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Samplette
+{
+// A kit bundle holds everything needed to play a process in a single
+// file: its control values, including the zones, and its decoded sample,
+// plus the compressed copy when the storage is not float. Kits saved from
+// a compressed copy alone only have that copy.
+//
+// The sample data is stored page-aligned after a small index so that
+// loading is one mapping of the file and one copy per channel, without
+// decoding nor resampling.
+struct kit
+{
+  // Control values by name, e.g. {"Gain", 1.f}
+  std::vector<std::pair<std::string, ossia::value>> controls;
+
+  // Name of the file the sample came from, for display
+  std::string sample_name;
+  // Null when only the compressed copy was read or saved
+  ossia::audio_handle sound;
+  int sample_rate{};
+
+  std::shared_ptr<const sample_store> store;
+};
+
+static constexpr const char kit_extension[]{"samplette"};
+
+bool write_kit(const std::string& path, const kit& kit);
+
+// Without `floats`, the float data of kits which have a compressed copy
+// is not read: they are played from the copy alone, in a half or three
+// quarters of the memory. Kits without float data get it decoded from
+// their copy when `floats` is set.
+[[nodiscard]] std::shared_ptr<const kit>
+read_kit(const std::string& path, bool floats = true);
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace Samplette
+{
+static constexpr const double max_lookahead_seconds{0.01};
+static constexpr const int limiter_chunk{256};
+
+// The limiter buffers are sized for the longest lookahead at this rate and
+// for this many channels, as many as the voices filter and pan.
+static constexpr const double max_limiter_rate{192000.};
+static constexpr const int max_limiter_channels{8};
+static constexpr const int max_lookahead_frames{
+    int(max_lookahead_seconds * max_limiter_rate)};
+
+[[nodiscard]] inline double db_to_gain(double db) noexcept
+{
+  return std::pow(10., db / 20.);
+}
+
+// Largest absolute value of each frame across the channels.
+// The inner loop goes across frames without branching, so that it is
+// vectorized.
+inline void frame_peaks(
+    const double* const* channels,
+    int count,
+    int frames,
+    float* peaks) noexcept
+{
+  std::fill_n(peaks, frames, 0.f);
+  for (int c = 0; c < count; c++)
+  {
+    const double* x = channels[c];
+    for (int j = 0; j < frames; j++)
+    {
+      const float a = std::abs(float(x[j]));
+      peaks[j] = peaks[j] < a ? a : peaks[j];
+    }
+  }
+}
+
+// Linked lookahead limiter: all the channels get the same gain.
+// The gain needed by each frame is held for the lookahead and smoothed by a
+// moving average of the same length, so that it reaches its minimum
+// exactly when the frame comes out of the delay line. It then recovers
+// with a one-pole release.
+class lookahead_limiter
+{
+public:
+  // All the allocations happen here, so that the limiter can be built
+  // with its node and only used on the audio thread afterwards
+  lookahead_limiter()
+      : m_hold(max_lookahead_frames + 1)
+      , m_box(max_lookahead_frames + 1, 1.f)
+      , m_delay(
+            max_limiter_channels,
+            std::vector<double>(max_lookahead_frames, 0.))
+  {
+  }
+
+  // Sets how much of the buffers is used, and resets the state when the
+  // lookahead changes. Longer lookaheads are clamped to the buffers.
+  void prepare(int lookahead) noexcept
+  {
+    lookahead = std::clamp(lookahead, 0, max_lookahead_frames);
+    if (lookahead != m_lookahead)
+    {
+      m_lookahead = lookahead;
+      reset();
+    }
+  }
+
+  void reset() noexcept
+  {
+    const int window = std::max(m_lookahead, 0) + 1;
+    std::fill_n(m_box.begin(), window, 1.f);
+    for (auto& d : m_delay)
+      std::fill_n(d.begin(), window - 1, 0.);
+    m_boxSum = window;
+    m_holdBegin = m_holdEnd = 0;
+    m_time = 0;
+    m_pos = 0;
+    m_gain = 1.f;
+    m_tail = 0;
+  }
+
+  // Frames of delay added to the signal
+  int latency() const noexcept { return std::max(m_lookahead, 0); }
+
+  // Nothing left in the delay line: silent input gives silent output
+  bool idle() const noexcept { return m_tail == 0; }
+
+  // Limits `frames` frames of the channels in place, delaying them by the
+  // lookahead. release is the one-pole coefficient of the gain recovery.
+  // Channels past max_limiter_channels are left as they are.
+  void process(
+      double* const* io,
+      std::size_t channels,
+      int64_t frames,
+      float ceiling,
+      float release) noexcept
+  {
+    channels = std::min(channels, m_delay.size());
+    const int window = m_lookahead + 1;
+    std::array<float, limiter_chunk> peaks;
+    std::array<double*, max_limiter_channels> chunk_io;
+
+    for (int64_t j0 = 0; j0 < frames; j0 += limiter_chunk)
+    {
+      const int n = std::min<int64_t>(limiter_chunk, frames - j0);
+      for (std::size_t c = 0; c < channels; c++)
+        chunk_io[c] = io[c] + j0;
+      frame_peaks(chunk_io.data(), channels, n, peaks.data());
+
+      for (int j = 0; j < n; j++)
+      {
+        const float peak = peaks[j];
+        const float target = peak > ceiling ? ceiling / peak : 1.f;
+
+        // Once the delay line has been silent for a whole window, the
+        // gain can go back to 1 without being heard
+        if (peak > 0.f)
+          m_tail = window;
+        else if (m_tail > 0 && --m_tail == 0)
+          m_gain = 1.f;
+
+        // Minimum over the window, with a monotonic queue
+        while (m_holdEnd > m_holdBegin
+               && m_hold[m_holdBegin % window].time + window <= m_time)
+          m_holdBegin++;
+        while (m_holdEnd > m_holdBegin
+               && m_hold[(m_holdEnd - 1) % window].gain >= target)
+          m_holdEnd--;
+        m_hold[m_holdEnd++ % window] = {target, m_time};
+        const float held = m_hold[m_holdBegin % window].gain;
+        m_time++;
+
+        const int box = m_pos % window;
+        m_boxSum += double(held) - m_box[box];
+        m_box[box] = held;
+        const float smoothed = std::min(1.f, float(m_boxSum / window));
+        m_gain = smoothed < m_gain ? smoothed
+                                   : m_gain + (smoothed - m_gain) * release;
+
+        if (m_lookahead > 0)
+        {
+          const int d = m_pos % m_lookahead;
+          for (std::size_t c = 0; c < channels; c++)
+          {
+            auto& line = m_delay[c];
+            const double x = chunk_io[c][j];
+            chunk_io[c][j] = line[d] * m_gain;
+            line[d] = x;
+          }
+        }
+        else
+        {
+          for (std::size_t c = 0; c < channels; c++)
+            chunk_io[c][j] *= m_gain;
+        }
+        m_pos++;
+      }
+    }
+  }
+
+private:
+  struct held_gain
+  {
+    float gain{1.f};
+    int64_t time{};
+  };
+
+  int m_lookahead{-1};
+  std::vector<held_gain> m_hold;
+  int64_t m_holdBegin{};
+  int64_t m_holdEnd{};
+  int64_t m_time{};
+
+  std::vector<float> m_box;
+  double m_boxSum{};
+  int64_t m_pos{};
+
+  std::vector<std::vector<double>> m_delay;
+  float m_gain{1.f};
+  int m_tail{};
+};
+}
@@ -0,0 +1,2527 @@
+#pragma once
+#include <ossia/dataflow/graph_node.hpp>
+#include <ossia/dataflow/nodes/sound_ref.hpp>
+#include <ossia/dataflow/nodes/sound_utils.hpp>
+#include <ossia/dataflow/nodes/timestretch/rubberband_stretcher.hpp>
+#include <ossia/dataflow/port.hpp>
+#include <ossia/detail/logger.hpp>
+
+#include <chrono>
+#include <limits>
+
+#include <Samplette/Analysis.hpp>
+#include <Samplette/Choke.hpp>
+#include <Samplette/FastMath.hpp>
+#include <Samplette/Filter.hpp>
+#include <Samplette/Freeze.hpp>
+#include <Samplette/Granular.hpp>
+#include <Samplette/Limiter.hpp>
+#include <Samplette/Panning.hpp>
+#include <Samplette/Prewarm.hpp>
+#include <Samplette/Reclaim.hpp>
+#include <Samplette/Render.hpp>
+#include <Samplette/Voices.hpp>
+#include <Samplette/Zones.hpp>
+
+namespace Samplette
+{
+template <typename T>
+struct deferred_value
+{
+  alignas(T) char bytes[sizeof(T)];
+  bool allocated{};
+  deferred_value() noexcept { }
+
+  deferred_value(const deferred_value&) = delete;
+  deferred_value(deferred_value&&) = delete;
+  deferred_value& operator=(const deferred_value&) = delete;
+  deferred_value& operator=(deferred_value&&) = delete;
+
+  template <typename... Args>
+  T& allocate(Args&&... args)
+  {
+    reset();
+    auto& ret = *new (&bytes) T(std::forward<Args>(args)...);
+    allocated = true;
+    return ret;
+  }
+
+  void reset() noexcept
+  {
+    if (allocated)
+    {
+      get().~T();
+      allocated = false;
+    }
+  }
+
+  T& get() noexcept { return *reinterpret_cast<T*>(&bytes); }
+
+  const T& get() const noexcept { return *reinterpret_cast<T*>(&bytes); }
+
+  ~deferred_value() { reset(); }
+};
+
+// Engines and buffers of a voice
+struct voice_resources
+{
+  ossia::audio_port port;
+  deferred_value<ossia::repitch_stretcher> pitcher;
+  deferred_value<ossia::rubberband_stretcher> stretcher;
+};
+
+// Engines and buffers of all the voices, indexed by voice_bank::slot.
+// The sounds share one set, made again by prepare_sound only when a
+// sound has more channels than it, or needs stretchers it does not
+// have: each slot plays one voice at a time whatever its sound.
+struct voice_resources_set
+{
+  std::size_t channels{};
+  // Stretchers are made for one channel count and rate, 0 if there are
+  // none
+  std::size_t stretcher_channels{};
+  int stretcher_rate{};
+  std::array<voice_resources, max_voices> voices;
+};
+
+class node final : public ossia::nonowning_graph_node
+{
+public:
+  node()
+  {
+    this->root_inputs().push_back(&in);
+
+    this->root_inputs().push_back(&trigger_mode);
+    this->root_inputs().push_back(&poly_mode);
+    this->root_inputs().push_back(&root);
+
+    this->root_inputs().push_back(&gain);
+
+    this->root_inputs().push_back(&start);
+    this->root_inputs().push_back(&length);
+
+    this->root_inputs().push_back(&loops);
+    this->root_inputs().push_back(&loop_start);
+
+    this->root_inputs().push_back(&pitch);
+
+    this->root_inputs().push_back(&attack);
+    this->root_inputs().push_back(&decay);
+    this->root_inputs().push_back(&sustain);
+    this->root_inputs().push_back(&release);
+
+    this->root_inputs().push_back(&velocity);
+    this->root_inputs().push_back(&fade);
+
+    this->root_inputs().push_back(&snap);
+    this->root_inputs().push_back(&gate_ramp);
+    this->root_inputs().push_back(&bend_range);
+    this->root_inputs().push_back(&mpe);
+    this->root_inputs().push_back(&engine);
+
+    this->root_inputs().push_back(&filter);
+    this->root_inputs().push_back(&cutoff);
+    this->root_inputs().push_back(&resonance);
+    this->root_inputs().push_back(&filter_env);
+    this->root_inputs().push_back(&filter_attack);
+    this->root_inputs().push_back(&filter_decay);
+    this->root_inputs().push_back(&key_track);
+    this->root_inputs().push_back(&filter_velocity);
+    this->root_inputs().push_back(&choke_group);
+
+    this->root_inputs().push_back(&sync);
+    this->root_inputs().push_back(&bpm);
+    this->root_inputs().push_back(&beats);
+
+    this->root_inputs().push_back(&storage);
+
+    this->root_inputs().push_back(&outputs);
+    this->root_inputs().push_back(&pan);
+    this->root_inputs().push_back(&spread);
+    this->root_inputs().push_back(&pan_key_track);
+    this->root_inputs().push_back(&pan_velocity);
+    this->root_inputs().push_back(&pan_random);
+
+    this->root_inputs().push_back(&zones);
+
+    this->root_inputs().push_back(&limiter);
+    this->root_inputs().push_back(&ceiling);
+    this->root_inputs().push_back(&lookahead);
+    this->root_inputs().push_back(&auto_gain);
+
+    this->root_inputs().push_back(&grain_size);
+    this->root_inputs().push_back(&grain_density);
+    this->root_inputs().push_back(&grain_position);
+    this->root_inputs().push_back(&grain_jitter);
+    this->root_inputs().push_back(&grain_shape);
+
+    this->root_inputs().push_back(&direction);
+    this->root_inputs().push_back(&key_map);
+
+    this->root_outputs().push_back(&out);
+    for (auto& bus : bus_out)
+      this->root_outputs().push_back(&bus);
+
+    for (int i = 0; i < max_voices; i++)
+      m_freeSlots[i] = max_voices - 1 - i;
+    m_freeCount = max_voices;
+    m_noteVoices.fill(-1);
+
+    m_envelope.resize(envelope_chunk);
+    m_splits.reserve(max_block_splits);
+    m_channelPointers.reserve(64);
+    for (auto& snd : m_sounds)
+      snd.data.reserve(64);
+    m_decodeCache.resize(max_filter_channels);
+    for (auto& c : m_decodeCache)
+    {
+      c.resize(decode_cache_frames);
+      m_cachePointers.push_back(c.data());
+    }
+    m_limiterPointers.reserve(64);
+    m_capture.reserve(max_captured_events);
+  }
+
+  // What a sound change needs which allocates or locks memory, made off
+  // the audio thread by prepare_sound: set_sound only swaps it in, and
+  // what it replaces is freed by reclaim_released.
+  // A sound with a compressed copy is only played from it: the node does
+  // not keep its float data.
+  struct prepared_sound
+  {
+    ossia::audio_handle handle;
+    std::shared_ptr<const sample_store> store;
+    int sample_rate{};
+    std::size_t channels{};
+    int64_t frames{};
+    std::shared_ptr<voice_resources_set> resources;
+    // Heads of the regions, see prewarm_seconds
+    page_locks locks;
+  };
+
+  // Controls which decide what is prepared with a sound, in the units of
+  // the node: the regions whose heads are locked, and whether the voices
+  // need stretchers.
+  struct prewarm_settings
+  {
+    double start{0.};
+    double length{1.};
+    double loop_start{0.};
+    play_direction direction{play_direction::Forward};
+    multisample key_map{parse_multisample({})};
+    bool sync{false};
+  };
+
+  // A sample the voices can play, with its compressed copy when there is
+  // one. A few of them are kept so that the voices started before a sound
+  // change finish on the sound they started with.
+  struct sound_source
+  {
+    std::shared_ptr<prepared_sound> prepared;
+    // Float data, empty when the sound plays from its store
+    ossia::audio_span<float> data;
+    const sample_store* store{};
+    std::size_t channels{};
+    int64_t frames{};
+    // Given after the sound like the store, used to skip its silent parts
+    std::shared_ptr<const sample_analysis> analysis;
+    sample_region region;
+    std::size_t sample_rate{};
+    // Voices playing it
+    int voices{};
+  };
+  static constexpr const int max_sounds{4};
+
+  static constexpr int voice_key(int channel, int note) noexcept
+  {
+    return channel * 128 + note;
+  }
+
+  // Voice engines are allocated once per slot and recycled: nothing is
+  // freed on the audio thread when a voice stops.
+  void add_voice(int channel, int note, int velocity)
+  {
+    // A note which is still held gets released before being retriggered
+    stop_voice(channel, note, m_gateRamp);
+
+    auto& snd = m_sounds[m_current];
+    if (snd.channels == 0)
+      return;
+
+    auto& v = m_voices;
+    int i{};
+    if (m_freeCount > 0)
+    {
+      i = v.count++;
+      v.slot[i] = m_freeSlots[--m_freeCount];
+    }
+    else
+    {
+      // Steal the oldest voice
+      i = v.oldest();
+      if (m_noteVoices[v.key[i]] == i)
+        m_noteVoices[v.key[i]] = -1;
+      m_sounds[v.sound[i]].voices--;
+      m_grains.remove_slot(v.slot[i]);
+    }
+    v.sound[i] = m_current;
+    snd.voices++;
+
+    auto& e = m_engines[v.slot[i]];
+    auto& r = snd.prepared->resources->voices[v.slot[i]];
+    e.engine = m_sync ? Stretch : m_engine;
+    // Sync was turned on after the sound was prepared: until it is
+    // prepared again with stretchers, the voices only follow the pitch
+    const auto& set = *snd.prepared->resources;
+    if (e.engine == Stretch
+        && (set.stretcher_channels != snd.channels
+            || std::size_t(set.stretcher_rate) != snd.sample_rate))
+      e.engine = Sinc;
+    switch (e.engine)
+    {
+      case Sinc:
+        r.pitcher.get().transport(0);
+        e.timing = {};
+        break;
+
+      case Stretch:
+        r.stretcher.get().transport(0);
+        e.pitch_scale = 1.;
+        e.timing = {};
+        break;
+
+      case Granular:
+        e.next_grain = 0;
+        break;
+
+      case Linear:
+        break;
+    }
+
+    v.key[i] = voice_key(channel, note);
+    v.channel[i] = channel;
+    v.note[i] = note;
+    v.velocity[i] = velocity / 127.f;
+    v.age[i] = m_voiceCounter++;
+    v.finished[i] = false;
+    v.pedal[i] = 0;
+    v.position[i] = 0.;
+    v.gain[i] = 1.f;
+    switch (m_direction)
+    {
+      case play_direction::Forward:
+        v.reverse[i] = false;
+        break;
+      case play_direction::Reverse:
+        v.reverse[i] = true;
+        break;
+      case play_direction::Alternate:
+        v.reverse[i] = m_nextReverse;
+        m_nextReverse = !m_nextReverse;
+        break;
+    }
+
+    // Multisamples: the key sample of the note gives the part of the sound
+    // to play and its root
+    int root = m_root;
+    const int64_t frames = snd.frames;
+    v.range_start[i] = 0;
+    v.range_length[i] = 0;
+    if (const int k = m_keyMap.note_sample[note];
+        k >= 0 && m_keyMap.samples[k].start < frames)
+    {
+      const auto& ks = m_keyMap.samples[k];
+      v.range_start[i] = ks.start;
+      v.range_length[i] = std::min(ks.length, frames - ks.start);
+      root = ks.root;
+    }
+    update_voice_region(i);
+
+    // Playback speed: the sample is at pitch root,
+    // we want it at the note's pitch
+    v.note_ratio[i] = root != 0 ? std::exp2((note - root) / 12.) : 1.;
+    v.ratio[i] = v.note_ratio[i];
+
+    // Envelope: m_attack / m_decay / m_release are in seconds
+    v.env_attack[i] = this->m_attack * m_sampleRate;
+    v.env_decay[i] = this->m_decay * m_sampleRate;
+    v.env_sustain[i] = this->m_sustainGain;
+    v.env_release[i] = this->m_release * m_sampleRate;
+    v.enter_stage(i, Attack);
+
+    // Per-note expression starts from the current state of its channel
+    if (m_mpe && channel != mpe_master_channel)
+    {
+      v.bend[i] = m_channelBend[channel];
+      v.pressure[i] = m_channelPressure[channel];
+      v.timbre[i] = m_channelTimbre[channel];
+    }
+    else
+    {
+      v.bend[i] = 0.f;
+      v.pressure[i] = 1.f;
+      v.timbre[i] = 0.5f;
+    }
+    v.bend_cents[i] = v.bend[i] * mpe_bend_range;
+    v.prev_pressure[i] = v.pressure[i];
+
+    v.filter_time[i] = 0;
+    for (int c = 0; c < max_filter_channels; c++)
+    {
+      v.svf_ic1[c][i] = 0.f;
+      v.svf_ic2[c][i] = 0.f;
+    }
+
+    // Pan: key tracking is in pan units per octave from the root note
+    float p = m_pan + m_panKeyTrack * (note - m_root) / 12.f
+              + m_panVelocity * (2.f * v.velocity[i] - 1.f);
+    if (m_panRandom > 0.)
+      p += m_panRandom * next_random(m_randomState);
+    v.pan[i] = p;
+    update_pan_gains(i);
+    v.bus[i] = m_zones.bus[note];
+    v.choke[i] = note_choke_group(note);
+
+    m_noteVoices[v.key[i]] = i;
+  }
+
+  void update_pan_gains(int i) noexcept
+  {
+    const int sources = std::min<int>(
+        m_sounds[m_voices.sound[i]].channels, max_filter_channels);
+    compute_pan_gains(
+        m_speakers,
+        sources,
+        m_voices.pan[i],
+        m_spread,
+        m_engines[m_voices.slot[i]].pan_gains.data());
+  }
+
+  // The playing voices keep their pan position in the new layout
+  void set_output_layout(output_layout layout) noexcept
+  {
+    if (layout == m_outputLayout)
+      return;
+    m_outputLayout = layout;
+    m_speakers = make_speaker_layout(layout);
+    for (int i = 0; i < m_voices.count; i++)
+      update_pan_gains(i);
+  }
+
+  // Number of channels written to the output
+  std::size_t output_channels() const noexcept
+  {
+    return m_outputLayout == output_layout::Source ? source_channels()
+                                                   : m_speakers.channels;
+  }
+
+  // Most channels among the current sound and the ones still played
+  std::size_t source_channels() const noexcept
+  {
+    std::size_t channels = m_sounds[m_current].channels;
+    for (const auto& snd : m_sounds)
+      if (snd.voices > 0)
+        channels = std::max(channels, snd.channels);
+    return channels;
+  }
+
+  // Ramps the voice down over `duration` seconds; it is retired at the end
+  // of the block in which its envelope finishes.
+  void stop_voice(int channel, int note, double duration)
+  {
+    const int key = voice_key(channel, note);
+    if (const int i = m_noteVoices[key]; i != -1)
+    {
+      m_voices.fast_release(i, duration * m_sampleRate);
+      m_voices.pedal[i] = 0;
+      m_noteVoices[key] = -1;
+    }
+  }
+
+  // Fast-releases the voices of a note choke group
+  void choke_voices(int group, double duration)
+  {
+    for (int i = 0; i < m_voices.count; i++)
+    {
+      if (m_voices.choke[i] != group)
+        continue;
+      m_voices.fast_release(i, duration * m_sampleRate);
+      m_voices.pedal[i] = 0;
+      if (m_noteVoices[m_voices.key[i]] == i)
+        m_noteVoices[m_voices.key[i]] = -1;
+    }
+  }
+
+  void stop_all_voices(double duration)
+  {
+    for (int i = 0; i < m_voices.count; i++)
+    {
+      m_voices.fast_release(i, duration * m_sampleRate);
+      m_voices.pedal[i] = 0;
+    }
+    m_noteVoices.fill(-1);
+  }
+
+  // Ends a held voice according to the trigger mode
+  void release_voice(int i)
+  {
+    auto& v = m_voices;
+    switch (this->m_triggerMode)
+    {
+      case Trigger:
+        v.enter_stage(i, Release);
+        break;
+      case Gate:
+        v.fast_release(i, m_gateRamp * m_sampleRate);
+        break;
+    }
+    v.pedal[i] = 0;
+    if (m_noteVoices[v.key[i]] == i)
+      m_noteVoices[v.key[i]] = -1;
+  }
+
+  // While a pedal holds the voice, the note off is only recorded: the voice
+  // stays in the note table so that retriggering the same note still cuts
+  // it.
+  void note_off(int channel, int note)
+  {
+    const int i = m_noteVoices[voice_key(channel, note)];
+    if (i == -1)
+      return;
+
+    auto& v = m_voices;
+    const bool held = m_sustainPedal
+                      || (m_sostenutoPedal && (v.pedal[i] & pedal_sostenuto));
+    if (held)
+      v.pedal[i] |= pedal_deferred;
+    else
+      release_voice(i);
+  }
+
+  // Releases the voices whose note off was deferred and which are not held
+  // by the other pedal anymore.
+  void release_deferred_voices()
+  {
+    auto& v = m_voices;
+    for (int i = 0; i < v.count; i++)
+    {
+      const uint8_t p = v.pedal[i];
+      if (!(p & pedal_deferred))
+        continue;
+      if (m_sustainPedal || (m_sostenutoPedal && (p & pedal_sostenuto)))
+        continue;
+      release_voice(i);
+    }
+  }
+
+  void set_sustain_pedal(bool down)
+  {
+    if (down == m_sustainPedal)
+      return;
+    m_sustainPedal = down;
+    if (!down)
+      release_deferred_voices();
+  }
+
+  // Sostenuto only holds the notes which are down when the pedal is pressed
+  void set_sostenuto_pedal(bool down)
+  {
+    if (down == m_sostenutoPedal)
+      return;
+    m_sostenutoPedal = down;
+
+    auto& v = m_voices;
+    if (down)
+    {
+      for (int i = 0; i < v.count; i++)
+      {
+        if (m_noteVoices[v.key[i]] == i && !(v.pedal[i] & pedal_deferred))
+          v.pedal[i] |= pedal_sostenuto;
+      }
+    }
+    else
+    {
+      release_deferred_voices();
+      for (int i = 0; i < v.count; i++)
+        v.pedal[i] &= ~pedal_sostenuto;
+    }
+  }
+
+  // Per-note expression: routes a channel message to the voices playing on
+  // that channel. There are only a handful of voices per channel in MPE so
+  // a linear scan of the active ones is the cheapest.
+  template <typename F>
+  void for_each_voice_on_channel(int channel, F&& f)
+  {
+    for (int i = 0; i < m_voices.count; i++)
+      if (m_voices.channel[i] == channel)
+        f(i);
+  }
+
+  // Finished voices give their slot back: no deallocation happens here
+  void retire_finished_voices() noexcept
+  {
+    auto& v = m_voices;
+    for (int i = v.count - 1; i >= 0; i--)
+    {
+      if (!v.finished[i])
+        continue;
+
+      if (m_noteVoices[v.key[i]] == i)
+        m_noteVoices[v.key[i]] = -1;
+      m_freeSlots[m_freeCount++] = v.slot[i];
+      m_sounds[v.sound[i]].voices--;
+      m_grains.remove_slot(v.slot[i]);
+
+      // The last voice is going to be moved in place of this one
+      const int last = v.count - 1;
+      if (i != last && m_noteVoices[v.key[last]] == last)
+        m_noteVoices[v.key[last]] = i;
+      v.remove(i);
+    }
+  }
+
+  // Hands a shared object the audio thread does not need anymore to the
+  // reclaim queue. If the queue is full it is released here: this only
+  // happens when nothing drains it, e.g. in an offline render.
+  template <typename T>
+  void defer_release(std::shared_ptr<T>& ptr) noexcept
+  {
+    if (!ptr)
+      return;
+    reclaim_queue<max_reclaimed>::item item = std::move(ptr);
+    m_reclaim.push(item);
+  }
+
+  // Called from a non-real-time thread to free what the node released
+  void reclaim_released() noexcept { m_reclaim.drain(); }
+
+  // The playing voices keep the sound they started with: the new sound goes
+  // in a free slot and only the voices started from now on play it.
+  // When every slot is still played, the oldest voices are cut short and
+  // the change waits for a slot to be free.
+  void set_sound(std::shared_ptr<prepared_sound> sound) noexcept
+  {
+    // A newer sound replaces the one waiting for a slot
+    defer_release(m_pendingSound);
+
+    int slot = m_current;
+    if (m_sounds[m_current].voices > 0)
+      slot = free_sound();
+
+    if (slot == -1)
+    {
+      m_pendingSound = std::move(sound);
+      for (int i = 0; i < m_voices.count; i++)
+      {
+        if (m_voices.sound[i] != m_current)
+          m_voices.fast_release(i, m_gateRamp * m_sampleRate);
+      }
+      return;
+    }
+
+    install_sound(slot, sound);
+  }
+
+  int free_sound() const noexcept
+  {
+    for (int k = 0; k < max_sounds; k++)
+      if (k != m_current && m_sounds[k].voices == 0)
+        return k;
+    return -1;
+  }
+
+  // The channel list has its capacity reserved upfront and the rest was
+  // done by prepare_sound.
+  void
+  install_sound(int slot, std::shared_ptr<prepared_sound>& sound) noexcept
+  {
+    auto& snd = m_sounds[slot];
+    release_sound(snd);
+    snd.prepared = std::move(sound);
+    const auto& prepared = *snd.prepared;
+    if (prepared.store)
+      snd.store = prepared.store.get();
+    else if (const auto& hdl = prepared.handle)
+      snd.data.assign(hdl->data.begin(), hdl->data.end());
+    snd.channels = prepared.channels;
+    snd.frames = prepared.frames;
+    snd.sample_rate = prepared.sample_rate;
+    if (m_analysis && snd.channels > 0 && m_analysis->frames == snd.frames)
+      snd.analysis = m_analysis;
+    m_current = slot;
+
+    update_region();
+    m_timeToFirstSample = -1;
+    m_measureFirstSample = true;
+  }
+
+  void release_sound(sound_source& snd) noexcept
+  {
+    defer_release(snd.prepared);
+    defer_release(snd.analysis);
+    snd.data.clear();
+    snd.store = nullptr;
+    snd.channels = 0;
+    snd.frames = 0;
+  }
+
+  // The sounds which are neither current nor played anymore are released,
+  // then a pending sound change can use their slot.
+  void release_unused_sounds() noexcept
+  {
+    for (int k = 0; k < max_sounds; k++)
+    {
+      auto& snd = m_sounds[k];
+      if (k != m_current && snd.voices == 0 && snd.prepared)
+        release_sound(snd);
+    }
+
+    if (m_pendingSound)
+    {
+      if (const int slot = free_sound(); slot != -1)
+        install_sound(slot, m_pendingSound);
+    }
+  }
+
+  // Whether a sound can be played from a compressed copy: the voices
+  // decode it in a cache sized for at most max_filter_channels channels.
+  static bool playable_store(const sample_store& store) noexcept
+  {
+    return store.size() > 0 && store.size() <= max_filter_channels
+           && store.frames > 0;
+  }
+
+  // Does the work which would otherwise happen on the first notes after a
+  // sound change: the engines of the voices are allocated for its channel
+  // count, unless those of the previous sound, `current`, fit it, and the
+  // heads of the regions are brought in memory and locked there. Called
+  // off the audio thread, the result goes to set_sound.
+  // The store is used instead of the float data if it matches it; either
+  // can be null.
+  [[nodiscard]] static std::shared_ptr<prepared_sound> prepare_sound(
+      const ossia::audio_handle& hdl,
+      std::shared_ptr<const sample_store> store,
+      int sampleRate,
+      const prewarm_settings& settings,
+      std::shared_ptr<voice_resources_set> current = {})
+  {
+    auto res = std::make_shared<prepared_sound>();
+    res->sample_rate = sampleRate;
+    if (hdl && !hdl->data.empty())
+    {
+      res->channels = hdl->data.size();
+      res->frames = hdl->data[0].size();
+    }
+    if (store
+        && (!playable_store(*store)
+            || (res->channels > 0
+                && (store->size() != res->channels
+                    || store->frames != res->frames))))
+      store.reset();
+
+    if (store)
+    {
+      res->channels = store->size();
+      res->frames = store->frames;
+      res->store = std::move(store);
+    }
+    else
+    {
+      res->handle = hdl;
+    }
+
+    const std::size_t channels = res->channels;
+    if (channels == 0 || res->frames == 0)
+      return res;
+
+    res->resources = std::move(current);
+    const auto* r = res->resources.get();
+    if (!r || r->channels < channels
+        || (settings.sync
+            && (r->stretcher_channels != channels
+                || r->stretcher_rate != sampleRate)))
+      res->resources = make_voice_resources(channels, sampleRate, settings);
+
+    // Multisamples: each key sample has its own head. Past the first ones
+    // the pages are only touched, the locks are full.
+    const int64_t frames = res->frames;
+    const auto prewarm = [&](int64_t start, int64_t length)
+    {
+      auto region = make_region(
+          length,
+          settings.start,
+          settings.length,
+          settings.loop_start,
+          nullptr);
+      region.start += start;
+      prewarm_region(*res, region, settings.direction);
+    };
+    prewarm(0, frames);
+    for (int k = 0; k < settings.key_map.count; k++)
+    {
+      const auto& ks = settings.key_map.samples[k];
+      if (ks.start < frames)
+        prewarm(ks.start, std::min(ks.length, frames - ks.start));
+    }
+    return res;
+  }
+
+  static std::shared_ptr<voice_resources_set> make_voice_resources(
+      std::size_t channels,
+      int sampleRate,
+      const prewarm_settings& settings)
+  {
+    auto res = std::make_shared<voice_resources_set>();
+    res->channels = channels;
+    if (settings.sync)
+    {
+      res->stretcher_channels = channels;
+      res->stretcher_rate = sampleRate;
+    }
+
+    // Pitchers run on as many of their channels as the sound has
+    for (auto& r : res->voices)
+    {
+      r.pitcher.allocate(channels, 1024, 0);
+      if (settings.sync)
+        r.stretcher.allocate(stretcher_options, channels, sampleRate, 0);
+
+      // Shrinking these later on does not free them
+      r.port.set_channels(channels);
+      for (auto& c : r.port.get())
+        c.resize(prewarm_buffer_size);
+    }
+    return res;
+  }
+
+  static void prewarm_region(
+      prepared_sound& sound,
+      const sample_region& region,
+      play_direction direction) noexcept
+  {
+    const int64_t head = std::min<int64_t>(
+        region.length, prewarm_seconds * sound.sample_rate);
+    if (head <= 0)
+      return;
+
+    // The bytes of the frames [start; start + head) of a channel
+    const auto prewarm = [&](const auto& bytes_of)
+    {
+      const auto lock = [&](int64_t start)
+      {
+        const auto bytes = bytes_of(start);
+        touch_pages(bytes.data(), bytes.size());
+        sound.locks.lock(bytes.data(), bytes.size());
+      };
+      lock(region.start);
+
+      // Reversed voices start from the end of the region
+      if (direction != play_direction::Forward)
+        lock(region.start + region.length - head);
+    };
+
+    if (sound.store)
+    {
+      for (std::size_t c = 0; c < sound.channels; c++)
+        prewarm([&](int64_t start)
+                { return sound.store->bytes(c, start, head); });
+    }
+    else
+    {
+      for (auto& chan : sound.handle->data)
+        prewarm(
+            [&](int64_t start)
+            { return std::as_bytes(std::span{chan}.subspan(start, head)); });
+    }
+  }
+
+  void set_analysis(std::shared_ptr<const sample_analysis> analysis)
+  {
+    defer_release(m_analysis);
+    m_analysis = std::move(analysis);
+
+    auto& snd = m_sounds[m_current];
+    defer_release(snd.analysis);
+    if (m_analysis && snd.channels > 0 && m_analysis->frames == snd.frames)
+      snd.analysis = m_analysis;
+    update_region();
+  }
+
+  // Computes the playback boundaries in frames from the percentage controls,
+  // for every sound as the controls apply to the voices already playing.
+  // Snapping is a binary search in the analysis so it is cheap enough to
+  // be done as soon as a control changes.
+  void update_region() noexcept
+  {
+    for (auto& snd : m_sounds)
+    {
+      const int64_t frames = snd.frames;
+      const sample_analysis* snap
+          = m_snap && m_analysis && m_analysis->frames == frames
+                ? m_analysis.get()
+                : nullptr;
+      snd.region = make_region(frames, m_start, m_length, m_loopStart, snap);
+    }
+    for (int i = 0; i < m_voices.count; i++)
+      update_voice_region(i);
+  }
+
+  // The region of a key sample is not snapped: the analysis is of the
+  // whole sound.
+  void update_voice_region(int i) noexcept
+  {
+    auto& v = m_voices;
+    if (v.range_length[i] == 0)
+    {
+      v.region[i] = m_sounds[v.sound[i]].region;
+      return;
+    }
+    v.region[i] = make_region(
+        v.range_length[i], m_start, m_length, m_loopStart, nullptr);
+    v.region[i].start += v.range_start[i];
+  }
+
+  // Keeps the MIDI received during playback so that the process can be
+  // rendered offline later. The buffer is allocated upfront; events past
+  // its capacity are dropped.
+  void capture_midi(int64_t date) noexcept
+  {
+    for (const libremidi::message& m : in->messages)
+    {
+      if (m_capture.size() == m_capture.capacity())
+        break;
+      if (m.bytes.empty() || m.bytes.size() > 3)
+        continue;
+
+      midi_event e;
+      e.date = date + m.timestamp;
+      e.size = m.bytes.size();
+      std::copy_n(m.bytes.begin(), e.size, e.bytes);
+      m_capture.push_back(e);
+    }
+  }
+
+  // Audio thread: the captured events are swapped with the empty buffer of
+  // the handoff, which is then left to the reclaim queue so that it is
+  // never freed here. Capture stops, as the new buffer has no room.
+  void hand_over_capture(std::shared_ptr<capture_handoff> handoff) noexcept
+  {
+    auto& c = handoff->capture;
+    c.events.swap(m_capture);
+    c.sample_rate = m_sampleRate;
+    c.buffer_size = m_bufferSize;
+    handoff->done.store(true, std::memory_order_release);
+    defer_release(handoff);
+  }
+
+  // The frozen render replaces the voices as long as it was made at the
+  // sample rate of the engine
+  void set_frozen(ossia::audio_handle frozen, int sample_rate)
+  {
+    defer_release(m_frozen);
+    m_frozen = std::move(frozen);
+    m_frozenRate = sample_rate;
+    stop_all_voices(m_gateRamp);
+  }
+
+  void play_frozen(int64_t date, int64_t first_pos, int64_t frames) noexcept
+  {
+    auto& data = m_frozen->data;
+    const std::size_t channels = data.size();
+    this->out->set_channels(std::max(this->out->channels(), channels));
+
+    for (std::size_t c = 0; c < channels; c++)
+    {
+      auto& o = this->out->get()[c];
+      o.resize(std::max<std::size_t>(o.size(), first_pos + frames));
+
+      const int64_t length = data[c].size();
+      const int64_t start = std::clamp<int64_t>(date, 0, length);
+      const int64_t n = std::min(frames, length - start);
+      for (int64_t j = 0; j < n; j++)
+        o[first_pos + j] += data[c][start + j];
+    }
+  }
+
+  void process_midi()
+  {
+    // First parse the MIDI input
+    for (libremidi::message& m : in->messages)
+    {
+      if (!m_window.contains(m.timestamp))
+        continue;
+
+      // Without MPE every channel plays the same voices
+      const int channel = m_mpe ? (m.bytes[0] & 0x0F) : 0;
+      const bool per_note = m_mpe && channel != mpe_master_channel;
+
+      switch (m.get_message_type())
+      {
+        case libremidi::message_type::NOTE_ON:
+          if (this->m_polyMode == Mono)
+          {
+            stop_all_voices(m_gateRamp);
+          }
+        {
+          // The process group only chokes the other members of the group,
+          // a note group also chokes the notes of this node in it
+          const int group = note_choke_group(m.bytes[1]);
+          if (group > 0)
+            choke_voices(group, m_gateRamp);
+          trigger_choke_group(group);
+          add_voice(channel, m.bytes[1], m.bytes[2]);
+          break;
+        }
+        case libremidi::message_type::NOTE_OFF:
+          note_off(channel, m.bytes[1]);
+          break;
+        case libremidi::message_type::PITCH_BEND:
+        {
+          const float bend = (m.bytes[2] * 128 + m.bytes[1] - 8192.f) / 8192.f;
+          if (per_note)
+          {
+            m_channelBend[channel] = bend;
+            for_each_voice_on_channel(
+                channel, [&](int i) { m_voices.bend[i] = bend; });
+          }
+          else
+          {
+            m_midiPitchBend = bend;
+          }
+          break;
+        }
+        case libremidi::message_type::AFTERTOUCH:
+        {
+          if (per_note)
+          {
+            const float pressure = m.bytes[1] / 127.f;
+            m_channelPressure[channel] = pressure;
+            for_each_voice_on_channel(
+                channel, [&](int i) { m_voices.pressure[i] = pressure; });
+          }
+          break;
+        }
+        case libremidi::message_type::POLY_PRESSURE:
+        {
+          const int i = m_noteVoices[voice_key(channel, m.bytes[1])];
+          if (i != -1)
+            m_voices.pressure[i] = m.bytes[2] / 127.f;
+          break;
+        }
+        case libremidi::message_type::CONTROL_CHANGE:
+        {
+          switch (m.bytes[1])
+          {
+            // Pedals apply to every channel, MPE included
+            case 64:
+              set_sustain_pedal(m.bytes[2] >= 64);
+              break;
+            case 66:
+              set_sostenuto_pedal(m.bytes[2] >= 64);
+              break;
+            case 74:
+              if (per_note)
+              {
+                const float timbre = m.bytes[2] / 127.f;
+                m_channelTimbre[channel] = timbre;
+                for_each_voice_on_channel(
+                    channel, [&](int i) { m_voices.timbre[i] = timbre; });
+              }
+              break;
+          }
+          break;
+        }
+        default:
+          break;
+      }
+    }
+  }
+
+  void set_choke_bus(std::shared_ptr<choke_bus> bus)
+  {
+    m_chokeBus = std::move(bus);
+    if (m_chokeBus)
+      for (int g = 0; g <= max_choke_groups; g++)
+        m_chokeSeen[g] = m_chokeBus->current(g);
+  }
+
+  // Group of a note: the one of its key sample, else the one of its zone
+  [[nodiscard]] int note_choke_group(int note) const noexcept
+  {
+    if (const int k = m_keyMap.note_sample[note];
+        k >= 0 && m_keyMap.samples[k].choke > 0)
+      return m_keyMap.samples[k].choke;
+    return m_zones.choke[note];
+  }
+
+  void trigger_choke_group(int note_group) noexcept
+  {
+    if (!m_chokeBus)
+      return;
+    if (m_chokeGroup > 0)
+      m_chokeSeen[m_chokeGroup] = m_chokeBus->trigger(m_chokeGroup);
+    if (note_group > 0 && note_group != m_chokeGroup)
+      m_chokeSeen[note_group] = m_chokeBus->trigger(note_group);
+  }
+
+  // Other nodes triggered voices in our groups since the last block.
+  // The bus only carries counters, so the cut happens at the start of the
+  // block rather than at the frame of the trigger: the nodes run in the
+  // order of the graph and a trigger from a node which runs before this
+  // one cuts up to a block early, one from a node which runs after it
+  // cuts at the start of the next block. Within a node, note groups cut
+  // at the frame of the note.
+  void apply_chokes() noexcept
+  {
+    if (!m_chokeBus)
+      return;
+
+    for (int g = 1; g <= max_choke_groups; g++)
+    {
+      const uint64_t triggers = m_chokeBus->current(g);
+      if (triggers == m_chokeSeen[g])
+        continue;
+      m_chokeSeen[g] = triggers;
+      if (g == m_chokeGroup)
+        stop_all_voices(m_gateRamp);
+      else
+        choke_voices(g, m_gateRamp);
+    }
+  }
+
+  // Part of the buffer whose MIDI and control values are being applied.
+  // Timestamps are clamped to the buffer so that early or late values
+  // apply at its start or end.
+  struct event_window
+  {
+    int64_t begin{std::numeric_limits<int64_t>::min()};
+    int64_t end{std::numeric_limits<int64_t>::max()};
+    int64_t first{std::numeric_limits<int64_t>::min()};
+    int64_t last{std::numeric_limits<int64_t>::max()};
+
+    bool contains(int64_t timestamp) const noexcept
+    {
+      timestamp = std::clamp(timestamp, first, last);
+      return timestamp >= begin && timestamp < end;
+    }
+  };
+
+  // Reads the last value of the port in the current window
+  template <typename T>
+  bool read_control(const ossia::value_port& in, auto& out) const
+  {
+    auto& d = in.get_data();
+    for (auto it = d.rbegin(); it != d.rend(); ++it)
+    {
+      if (m_window.contains(it->timestamp))
+      {
+        out = ossia::convert<T>(it->value);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void process_controls()
+  {
+    // The control toggles between "Trigger" and "Gate": true is Gate, as
+    // in the executor. Offline renders only set it through this inlet.
+    std::optional<bool> trigger_mode_v;
+    read_control<bool>(*this->trigger_mode, trigger_mode_v);
+    if (trigger_mode_v)
+    {
+      this->m_triggerMode = *trigger_mode_v ? Gate : Trigger;
+    }
+    std::optional<std::string> poly_mode_v;
+    read_control<std::string>(*this->poly_mode, poly_mode_v);
+    if (poly_mode_v)
+    {
+      if (*poly_mode_v == "Mono")
+        this->m_polyMode = Mono;
+      else
+        this->m_polyMode = Poly;
+    }
+
+    std::optional<int> root_v{};
+    read_control<int>(*this->root, root_v);
+    if (root_v)
+    {
+      this->m_root = *root_v;
+    }
+
+    read_control<float>(*this->gain, this->m_gain);
+    bool region_changed = false;
+    if (read_control<float>(*this->start, this->m_start))
+    {
+      this->m_start /= 100.;
+      region_changed = true;
+    }
+
+    if (read_control<float>(*this->length, this->m_length))
+    {
+      this->m_length /= 100.;
+      region_changed = true;
+    }
+
+    read_control<bool>(*this->loops, this->m_loops);
+    if (read_control<float>(*this->loop_start, this->m_loopStart))
+    {
+      this->m_loopStart /= 100.;
+      region_changed = true;
+    }
+
+    region_changed |= read_control<bool>(*this->snap, this->m_snap);
+    if (region_changed)
+      update_region();
+
+    read_control<float>(*this->pitch, this->m_userPitchShift);
+    read_control<int>(*this->bend_range, this->m_bendRange);
+    read_control<bool>(*this->mpe, this->m_mpe);
+
+    // UI control is in msec, ADSR is in sec
+    if (read_control<float>(*this->attack, this->m_attack))
+      this->m_attack /= 1000.;
+    if (read_control<float>(*this->decay, this->m_decay))
+      this->m_decay /= 1000.;
+    read_control<float>(*this->sustain, this->m_sustainGain);
+    if (read_control<float>(*this->release, this->m_release))
+      this->m_release /= 1000.;
+
+    read_control<float>(*this->velocity, this->m_velocity);
+    read_control<float>(*this->fade, this->m_fade);
+
+    if (read_control<float>(*this->gate_ramp, this->m_gateRamp))
+      this->m_gateRamp /= 1000.;
+
+    std::optional<std::string> engine_v;
+    read_control<std::string>(*this->engine, engine_v);
+    if (engine_v)
+      this->m_engine = engine_from_string(*engine_v);
+
+    std::optional<std::string> filter_v;
+    read_control<std::string>(*this->filter, filter_v);
+    if (filter_v)
+      this->m_filterMode = filter_mode_from_string(*filter_v);
+    read_control<float>(*this->cutoff, this->m_cutoff);
+    read_control<float>(*this->resonance, this->m_resonance);
+    read_control<float>(*this->filter_env, this->m_filterEnv);
+    if (read_control<float>(*this->filter_attack, this->m_filterAttack))
+      this->m_filterAttack /= 1000.;
+    if (read_control<float>(*this->filter_decay, this->m_filterDecay))
+      this->m_filterDecay /= 1000.;
+    if (read_control<float>(*this->key_track, this->m_keyTrack))
+      this->m_keyTrack /= 100.;
+    read_control<float>(*this->filter_velocity, this->m_filterVelocity);
+
+    if (read_control<int>(*this->choke_group, this->m_chokeGroup))
+      this->m_chokeGroup = std::clamp(this->m_chokeGroup, 0, max_choke_groups);
+
+    read_control<bool>(*this->sync, this->m_sync);
+    read_control<float>(*this->bpm, this->m_nativeTempo);
+    read_control<int>(*this->beats, this->m_beats);
+
+    std::optional<std::string> outputs_v;
+    read_control<std::string>(*this->outputs, outputs_v);
+    if (outputs_v)
+      set_output_layout(output_layout_from_string(*outputs_v));
+    read_control<float>(*this->pan, this->m_pan);
+    read_control<float>(*this->spread, this->m_spread);
+    read_control<float>(*this->pan_key_track, this->m_panKeyTrack);
+    read_control<float>(*this->pan_velocity, this->m_panVelocity);
+    read_control<float>(*this->pan_random, this->m_panRandom);
+
+    std::optional<std::string> zones_v;
+    read_control<std::string>(*this->zones, zones_v);
+    if (zones_v)
+      this->m_zones = parse_zones(*zones_v);
+
+    read_control<bool>(*this->limiter, this->m_limiter);
+    if (read_control<float>(*this->ceiling, this->m_ceiling))
+      this->m_ceiling = db_to_gain(this->m_ceiling);
+    if (read_control<float>(*this->lookahead, this->m_lookahead))
+      this->m_lookahead /= 1000.;
+    read_control<bool>(*this->auto_gain, this->m_autoGain);
+
+    if (read_control<float>(*this->grain_size, this->m_grainSize))
+      this->m_grainSize /= 1000.;
+    read_control<float>(*this->grain_density, this->m_grainDensity);
+    if (read_control<float>(*this->grain_position, this->m_grainPosition))
+      this->m_grainPosition /= 100.;
+    if (read_control<float>(*this->grain_jitter, this->m_grainJitter))
+      this->m_grainJitter /= 100.;
+    std::optional<std::string> window_v;
+    read_control<std::string>(*this->grain_shape, window_v);
+    if (window_v)
+      this->m_grainWindow = grain_window_from_string(*window_v);
+
+    std::optional<std::string> direction_v;
+    read_control<std::string>(*this->direction, direction_v);
+    if (direction_v)
+      this->m_direction = play_direction_from_string(*direction_v);
+
+    std::optional<std::string> key_map_v;
+    read_control<std::string>(*this->key_map, key_map_v);
+    if (key_map_v)
+      this->m_keyMap = parse_multisample(*key_map_v);
+  }
+
+  static filter_mode filter_mode_from_string(const std::string& str) noexcept
+  {
+    if (str == "Low-pass")
+      return filter_mode::LowPass;
+    else if (str == "High-pass")
+      return filter_mode::HighPass;
+    else if (str == "Band-pass")
+      return filter_mode::BandPass;
+    return filter_mode::Off;
+  }
+
+  // Pitch and bend are intervals: they multiply the playback speed.
+  // They are smoothed once per block so that jumps do not click, and the
+  // per-voice ratios are then computed in a single pass over the voices.
+  void update_pitch(double smoothing) noexcept
+  {
+    const double target
+        = 100. * (m_userPitchShift + m_midiPitchBend * m_bendRange);
+    m_pitchCents += (target - m_pitchCents) * smoothing;
+
+    auto& v = m_voices;
+    const float global_cents = m_pitchCents;
+    for (int i = 0; i < v.count; i++)
+    {
+      v.bend_cents[i]
+          += (v.bend[i] * mpe_bend_range - v.bend_cents[i]) * smoothing;
+      v.ratio[i]
+          = v.note_ratio[i] * cents_to_ratio(global_cents + v.bend_cents[i]);
+    }
+  }
+
+  // Cutoff of each voice, in octaves around the "Cutoff" control:
+  // the filter envelope is an attack / exponential decay evaluated once
+  // per block, and key tracking is relative to the root note. The decay
+  // stops at -120 dB, past which fast_exp2 would leave its range: the
+  // envelope then stays at 0 for as long as the note is held.
+  void update_filter(int64_t frames) noexcept
+  {
+    auto& v = m_voices;
+    const double sr = m_sampleRate;
+    const double attack = m_filterAttack * sr;
+    const double decay = std::max(m_filterDecay * sr, 1.);
+    for (int i = 0; i < v.count; i++)
+    {
+      const double t = v.filter_time[i];
+      const double decayed = std::numbers::log2e * (t - attack) / decay;
+      const bool ended = t >= attack && decayed >= 20.;
+      const double env = t < attack ? t / attack
+                         : ended    ? 0.
+                                    : fast_exp2(-decayed);
+
+      double octaves = m_filterEnv * env
+                       + m_keyTrack * (v.note[i] - m_root) / 12.
+                       + m_filterVelocity * v.velocity[i];
+      if (m_mpe)
+        octaves += 4. * (v.timbre[i] - 0.5);
+
+      const auto c = svf_coefficients::make(
+          m_cutoff * fast_exp2(octaves), m_resonance, sr);
+      v.svf_k[i] = c.k;
+      v.svf_a1[i] = c.a1;
+      v.svf_a2[i] = c.a2;
+      v.svf_a3[i] = c.a3;
+      if (!ended)
+        v.filter_time[i] += frames;
+    }
+  }
+
+  // Filters all the voices together, one channel at a time: their
+  // outputs are interleaved in chunks so that the filter kernel runs
+  // across voices.
+  template <filter_mode Mode>
+  void filter_voices(int64_t frames) noexcept
+  {
+    auto& v = m_voices;
+    const int count = v.count;
+    const int channels = std::min<int>(source_channels(), max_filter_channels);
+    float* x = m_filterScratch.data();
+
+    // Voices playing a sound with fewer channels are filtered on silence
+    for (int c = 0; c < channels; c++)
+    {
+      for (int64_t j0 = 0; j0 < frames; j0 += filter_chunk)
+      {
+        const int n = std::min<int64_t>(filter_chunk, frames - j0);
+        for (int i = 0; i < count; i++)
+        {
+          auto& port = resources(i).port.get();
+          if (std::size_t(c) >= port.size())
+          {
+            for (int j = 0; j < n; j++)
+              x[j * max_voices + i] = 0.f;
+            continue;
+          }
+          const double* in = port[c].data() + j0;
+          for (int j = 0; j < n; j++)
+            x[j * max_voices + i] = in[j];
+        }
+
+        svf_process<Mode>(
+            x,
+            n,
+            count,
+            max_voices,
+            v.svf_k.data(),
+            v.svf_a1.data(),
+            v.svf_a2.data(),
+            v.svf_a3.data(),
+            v.svf_ic1[c].data(),
+            v.svf_ic2[c].data());
+
+        for (int i = 0; i < count; i++)
+        {
+          auto& port = resources(i).port.get();
+          if (std::size_t(c) >= port.size())
+            continue;
+          double* out = port[c].data() + j0;
+          for (int j = 0; j < n; j++)
+            out[j] = x[j * max_voices + i];
+        }
+      }
+    }
+  }
+
+  // Native tempo of the sample: given directly, or deduced from the length
+  // of the region in beats.
+  double native_tempo() const noexcept
+  {
+    const auto& snd = m_sounds[m_current];
+    if (m_beats > 0 && snd.region.length > 0 && snd.sample_rate > 0)
+      return m_beats * 60. * snd.sample_rate / snd.region.length;
+    return m_nativeTempo;
+  }
+
+  // In sync mode the samples are played at the speed which makes their
+  // native tempo match the one of the transport. The speed is smoothed
+  // like the pitch so that tempo changes do not click.
+  void update_sync(const ossia::token_request& tk, double smoothing) noexcept
+  {
+    double target = 1.;
+    if (m_sync)
+    {
+      const double native = native_tempo();
+      if (native > 0. && tk.tempo > 0.)
+        target = tk.tempo / native;
+    }
+    m_syncSpeed += (target - m_syncSpeed) * smoothing;
+  }
+
+  // Reads the playback region of a voice for the stretchers
+  struct region_fetcher
+  {
+    const node& n;
+    const sound_source& snd;
+    const sample_region& region;
+    bool reverse{};
+    void fetch_audio(
+        const int64_t start,
+        const int64_t samples_to_write,
+        float** const audio_array) noexcept
+    {
+      if (snd.store)
+        read_region(
+            *snd.store,
+            region,
+            n.m_loops,
+            start,
+            samples_to_write,
+            audio_array,
+            reverse);
+      else
+        read_region(
+            snd.data,
+            region,
+            n.m_loops,
+            start,
+            samples_to_write,
+            audio_array,
+            reverse);
+    }
+  };
+
+  // The compressed sample is decoded in the cache as playback advances,
+  // by chunks which fit in it. The voices are rendered one after the
+  // other so they can all use the same cache.
+  void render_linear_from_store(
+      const sound_source& snd,
+      int i,
+      int64_t frames) noexcept
+  {
+    auto& v = m_voices;
+    const double ratio = v.ratio[i];
+    const int64_t chunk = (decode_cache_frames - 2) / ratio;
+    if (chunk <= 0)
+      return;
+
+    const std::size_t channels = snd.store->size();
+    double* out[max_filter_channels];
+    for (int64_t done = 0; done < frames; done += chunk)
+    {
+      const int64_t n = std::min(chunk, frames - done);
+      for (std::size_t c = 0; c < channels; c++)
+        out[c] = m_channelPointers[c] + done;
+
+      v.position[i] = read_region_linear_cached(
+          *snd.store,
+          v.region[i],
+          m_loops,
+          v.position[i],
+          ratio,
+          out,
+          n,
+          m_cachePointers.data(),
+          v.reverse[i]);
+    }
+  }
+
+  // Engines and buffers of a voice, from the sound it plays
+  voice_resources& resources(int i) noexcept
+  {
+    const auto& snd = m_sounds[m_voices.sound[i]];
+    return snd.prepared->resources->voices[m_voices.slot[i]];
+  }
+
+  void render_voice(ossia::exec_state_facade s, int i, int64_t frames)
+  {
+    auto& v = m_voices;
+    auto& e = m_engines[v.slot[i]];
+    const auto& snd = m_sounds[v.sound[i]];
+    auto& r = snd.prepared->resources->voices[v.slot[i]];
+    const auto channels = snd.channels;
+
+    r.port.set_channels(channels);
+    for (auto& c : r.port.get())
+      c.resize(frames);
+
+    if (v.ratio[i] <= 0.000001)
+    {
+      for (auto& c : r.port.get())
+        std::fill(c.begin(), c.end(), 0.);
+      return;
+    }
+
+    switch (e.engine)
+    {
+      case Sinc:
+      {
+        e.timing.tempo = ossia::root_tempo * v.ratio[i];
+        e.timing.date += frames;
+
+        region_fetcher fetcher{*this, snd, v.region[i], v.reverse[i]};
+        ossia::mutable_audio_span<double> output = r.port;
+        auto& pitcher = r.pitcher.get();
+        pitcher.run(
+            fetcher,
+            e.timing,
+            s,
+            1. / v.ratio[i],
+            channels,
+            snd.frames,
+            int64_t(frames * v.ratio[i]),
+            frames,
+            0,
+            output);
+        e.timing.prev_date = e.timing.date;
+        v.position[i] = pitcher.next_sample_to_read;
+        break;
+      }
+
+      case Stretch:
+      {
+        // The duration follows the tempo and the pitch is set separately
+        const double speed = m_syncSpeed;
+        e.timing.tempo = ossia::root_tempo * speed;
+        e.timing.date += frames;
+
+        auto& stretcher = r.stretcher.get();
+        if (e.pitch_scale != v.ratio[i])
+        {
+          stretcher.m_rubberBand->setPitchScale(v.ratio[i]);
+          e.pitch_scale = v.ratio[i];
+        }
+
+        region_fetcher fetcher{*this, snd, v.region[i], v.reverse[i]};
+        ossia::mutable_audio_span<double> output = r.port;
+        stretcher.run(
+            fetcher,
+            e.timing,
+            s,
+            1. / speed,
+            channels,
+            snd.frames,
+            int64_t(frames * speed),
+            frames,
+            0,
+            output);
+        e.timing.prev_date = e.timing.date;
+        v.position[i] = stretcher.next_sample_to_read;
+        break;
+      }
+
+      case Linear:
+      {
+        // Silent parts of the sample are not resampled: the voice only
+        // moves forward
+        const double span = (frames - 1) * v.ratio[i];
+        if (region_silent(
+                snd, v.region[i], v.reverse[i], v.position[i], span))
+        {
+          for (auto& c : r.port.get())
+            std::fill(c.begin(), c.end(), 0.);
+          v.position[i] += frames * v.ratio[i];
+          break;
+        }
+
+        m_channelPointers.clear();
+        for (auto& c : r.port.get())
+          m_channelPointers.push_back(c.data());
+
+        if (snd.store)
+          render_linear_from_store(snd, i, frames);
+        else
+          v.position[i] = read_region_linear(
+              snd.data,
+              v.region[i],
+              m_loops,
+              v.position[i],
+              v.ratio[i],
+              m_channelPointers.data(),
+              frames,
+              v.reverse[i]);
+        break;
+      }
+
+      case Granular:
+      {
+        for (auto& c : r.port.get())
+          std::fill(c.begin(), c.end(), 0.);
+        start_grains(i, frames);
+        break;
+      }
+    }
+  }
+
+  // Whether the frames a voice reads from `position` over `span` frames,
+  // counted in its direction from the region start or end, are all under
+  // silence_level. Reads which wrap around the loop are not checked.
+  bool region_silent(
+      const sound_source& snd,
+      const sample_region& playback,
+      bool reverse,
+      double position,
+      double span) const noexcept
+  {
+    if (!snd.analysis || position < 0.)
+      return false;
+    const auto region = directed_region(playback, m_loops, reverse);
+    const int64_t first = position;
+    const int64_t last = int64_t(position + span) + 1;
+    if (last >= region.length)
+      return false;
+    if (reverse)
+    {
+      const int64_t end = region.start + region.length - 1;
+      return snd.analysis->silent(end - last, end - first, silence_level);
+    }
+    return snd.analysis->silent(
+        region.start + first, region.start + last, silence_level);
+  }
+
+  // Schedules the grains of a voice which start in the next `frames`
+  // frames. They are rendered for all the voices at once by
+  // render_grains.
+  void start_grains(int i, int64_t frames) noexcept
+  {
+    auto& e = m_engines[m_voices.slot[i]];
+    const double interval
+        = m_sampleRate / std::clamp(m_grainDensity, 1., m_sampleRate);
+    for (; e.next_grain < frames;)
+    {
+      start_grain(i, e.next_grain, interval);
+      // Jitter also moves the onsets so that dense clouds do not comb
+      const double next
+          = interval * (1. + 0.5 * m_grainJitter * next_random(m_grainRandom));
+      e.next_grain += std::max<int64_t>(1, next);
+    }
+    e.next_grain -= frames;
+  }
+
+  void start_grain(int i, int64_t delay, double interval) noexcept
+  {
+    auto& v = m_voices;
+    const auto& snd = m_sounds[v.sound[i]];
+    const int64_t frames = snd.frames;
+    const double step = v.ratio[i];
+    int64_t length = std::max(2., m_grainSize * m_sampleRate);
+
+    // Grains never read past the data: longer ones than the sample are
+    // shortened, the others are moved back into the region.
+    const double last = frames - 2;
+    if ((length - 1) * step > last)
+      length = last / step + 1;
+    if (length < 2)
+      return;
+    const double span = (length - 1) * step;
+
+    const auto& region = v.region[i];
+    double pos = m_grainPosition;
+    if (m_grainJitter > 0.)
+      pos += m_grainJitter * next_random(m_grainRandom);
+    pos = std::clamp(pos, 0., 1.) * region.length;
+
+    // Lowest frame the grain reads: reversed grains start from the other
+    // end, and their position is counted from the region end.
+    const bool reverse = v.reverse[i];
+    const double first = region.start;
+    const double end = region.start + region.length;
+    double low = reverse ? end - 1 - pos - span : first + pos;
+    low = std::clamp(low, first, std::max(first, end - 1 - span));
+    low = std::clamp(low, 0., last - span);
+
+    // Silent grains are not played at all
+    if (snd.analysis
+        && snd.analysis->silent(
+            int64_t(low), int64_t(low + span) + 1, silence_level))
+      return;
+
+    const int k = m_grains.add();
+    if (k == -1)
+      return;
+
+    // Hann windows overlapping by half add up to one; denser grains are
+    // scaled down as uncorrelated signals.
+    const double overlap = length / interval;
+    auto& g = m_grains;
+    g.slot[k] = v.slot[i];
+    g.sound[k] = v.sound[i];
+    g.position[k] = reverse ? low + span : low;
+    g.step[k] = reverse ? -step : step;
+    g.phase[k] = 0.f;
+    g.phase_step[k] = 1.f / length;
+    g.window[k] = m_grainWindow;
+    g.gain[k] = std::min(1., std::sqrt(2. / overlap));
+    g.delay[k] = delay;
+    g.remaining[k] = length;
+    v.position[i] = reverse ? end - 1 - g.position[k] : low - first;
+  }
+
+  // Mixes the grains in the buffers of their voice, before the voices go
+  // through the filter and envelope like with the other engines. Grains
+  // read the float data directly, without a copy.
+  void render_grains(int64_t frames) noexcept
+  {
+    auto& g = m_grains;
+    const float* in[max_filter_channels];
+    double* out[max_filter_channels];
+    for (int k = g.count - 1; k >= 0; k--)
+    {
+      const int64_t delay = std::min<int64_t>(g.delay[k], frames);
+      g.delay[k] -= delay;
+      const int64_t n = std::min<int64_t>(frames - delay, g.remaining[k]);
+      if (n > 0)
+      {
+        const auto& snd = m_sounds[g.sound[k]];
+        auto& port = snd.prepared->resources->voices[g.slot[k]].port.get();
+        const std::size_t channels = std::min<std::size_t>(
+            std::min(snd.channels, port.size()), max_filter_channels);
+        for (std::size_t c = 0; c < channels; c++)
+          out[c] = port[c].data() + delay;
+
+        if (snd.store)
+        {
+          mix_grain_from_store(*snd.store, k, channels, out, n);
+        }
+        else
+        {
+          for (std::size_t c = 0; c < channels; c++)
+            in[c] = snd.data[c].data();
+          mix_grain(
+              in,
+              channels,
+              g.position[k],
+              g.step[k],
+              m_grainWindows.table(g.window[k]),
+              g.phase[k],
+              g.phase_step[k],
+              g.gain[k],
+              out,
+              n);
+        }
+        g.position[k] += n * g.step[k];
+        g.phase[k] += n * g.phase_step[k];
+        g.remaining[k] -= n;
+      }
+
+      // The last grain, which takes its place, was already rendered
+      if (g.remaining[k] <= 0)
+        g.remove(k);
+    }
+  }
+
+  // The frames a grain reads from a compressed sound are decoded in the
+  // cache first, by chunks which fit in it
+  void mix_grain_from_store(
+      const sample_store& store,
+      int k,
+      std::size_t channels,
+      double* const* out,
+      int64_t frames) noexcept
+  {
+    const auto& g = m_grains;
+    const double step = g.step[k];
+    const int64_t chunk
+        = (decode_cache_frames - 2) / std::max(1., std::abs(step));
+    double* o[max_filter_channels];
+    for (int64_t done = 0; done < frames; done += chunk)
+    {
+      const int64_t n = std::min(chunk, frames - done);
+      const double first = g.position[k] + done * step;
+      const double last = first + (n - 1) * step;
+      const int64_t low = std::min(first, last);
+      const int64_t count = std::min<int64_t>(
+          int64_t(std::max(first, last)) - low + 2, store.frames - low);
+      for (std::size_t c = 0; c < channels; c++)
+      {
+        store.decode(c, low, count, m_cachePointers[c]);
+        o[c] = out[c] + done;
+      }
+
+      mix_grain(
+          m_cachePointers.data(),
+          channels,
+          first - low,
+          step,
+          m_grainWindows.table(g.window[k]),
+          g.phase[k] + done * g.phase_step[k],
+          g.phase_step[k],
+          g.gain[k],
+          o,
+          n);
+    }
+  }
+
+  void mix_voice(int i, int64_t first_pos, int64_t frames)
+  {
+    auto& v = m_voices;
+    auto& e = m_engines[v.slot[i]];
+    const auto channels = m_sounds[v.sound[i]].channels;
+
+    // Gain and pressure both ramp linearly over the segment
+    const float gain = m_prevGain;
+    const float gain_step = (m_mixGain - m_prevGain) / frames;
+    const float pressure = v.prev_pressure[i];
+    const float pressure_step = (v.pressure[i] - pressure) / frames;
+    v.prev_pressure[i] = v.pressure[i];
+
+    // Envelope, gain and pressure are folded into a single gain curve.
+    // In the sustain stage with steady gain and pressure, which is where
+    // held notes spend most of their time, the curve is a constant.
+    const bool constant = v.env_stage[i] == Sustain && gain_step == 0.f
+                          && pressure_step == 0.f;
+    const auto mix = mix_kernels[constant];
+    auto& voice_samples = resources(i).port.get();
+    auto& out_samples = bus_port(v.bus[i]).get();
+
+    // Mixes n frames from `offset` in the segment to the output
+    float* env = m_envelope.data();
+    const auto mix_frames = [&](float level, int64_t offset, int64_t n)
+    {
+      if (m_outputLayout == output_layout::Source)
+      {
+        for (std::size_t c = 0; c < channels; c++)
+          mix(voice_samples[c].data() + offset,
+              env,
+              level,
+              out_samples[c].data() + first_pos + offset,
+              n);
+        return;
+      }
+
+      // Each source channel only reaches the one or two speakers around
+      // its pan position: the other gains are zero and skipped.
+      const int sources = std::min<int>(channels, max_filter_channels);
+      const float* g = e.pan_gains.data();
+      for (int o = 0; o < m_speakers.channels; o++, g += max_filter_channels)
+      {
+        double* out = out_samples[o].data() + first_pos + offset;
+        for (int c = 0; c < sources; c++)
+        {
+          const float gc = g[c];
+          if (gc == 0.f)
+            continue;
+          mix(voice_samples[c].data() + offset, env, level * gc, out, n);
+        }
+      }
+    };
+
+    // Voices which can only get quieter are retired as soon as they are
+    // not heard, instead of running until the end of their envelope
+    if (constant)
+    {
+      const float level = v.env_level[i] * gain * pressure;
+      if (fading(i)
+          && voice_peak(voice_samples, channels, 0, frames) * level
+                 < silence_level)
+        v.finished[i] = true;
+      mix_frames(level, 0, frames);
+      return;
+    }
+
+    // Otherwise the curve is rendered by chunks which fit in m_envelope
+    float peak = 0.f;
+    for (int64_t done = 0; done < frames;)
+    {
+      const int chunk = std::min<int64_t>(frames - done, envelope_chunk);
+      const int n = v.render_envelope(i, env, chunk);
+      for (int j = 0; j < n; j++)
+      {
+        const int64_t k = done + j;
+        env[j] *= (gain + gain_step * k) * (pressure + pressure_step * k);
+      }
+      peak = std::max(peak, voice_peak(voice_samples, channels, env, done, n));
+      mix_frames(1.f, done, n);
+      if (n < chunk)
+        break;
+      done += chunk;
+    }
+    if (fading(i) && peak < silence_level)
+      v.finished[i] = true;
+  }
+
+  // The voice is releasing and already quiet, or has played its whole
+  // region: its output can only decrease.
+  bool fading(int i) const noexcept
+  {
+    const auto& v = m_voices;
+    if (v.env_stage[i] == Release && v.env_level[i] < release_floor)
+      return true;
+    return !m_loops && m_engines[v.slot[i]].engine != Granular
+           && v.position[i] >= v.region[i].length;
+  }
+
+  // Largest absolute value of n frames of the voice's output
+  static float voice_peak(
+      const ossia::audio_vector& samples,
+      std::size_t channels,
+      int64_t offset,
+      int64_t n) noexcept
+  {
+    double peak = 0.;
+    for (std::size_t c = 0; c < channels; c++)
+    {
+      const double* x = samples[c].data() + offset;
+      for (int64_t j = 0; j < n; j++)
+        peak = std::max(peak, std::abs(x[j]));
+    }
+    return peak;
+  }
+
+  // Same, once multiplied by the envelope
+  static float voice_peak(
+      const ossia::audio_vector& samples,
+      std::size_t channels,
+      const float* env,
+      int64_t offset,
+      int64_t n) noexcept
+  {
+    double peak = 0.;
+    for (std::size_t c = 0; c < channels; c++)
+    {
+      const double* x = samples[c].data() + offset;
+      for (int64_t j = 0; j < n; j++)
+        peak = std::max(peak, std::abs(x[j] * env[j]));
+    }
+    return peak;
+  }
+
+  // With auto gain the voices are scaled so that their sum keeps about the
+  // level of a single voice: uncorrelated voices add up in power, hence the
+  // square root.
+  double mix_gain() const noexcept
+  {
+    if (!m_autoGain || m_voices.count <= 1)
+      return m_gain;
+    return m_gain / std::sqrt(double(m_voices.count));
+  }
+
+  // Delay added to the output by the limiter, in frames
+  int64_t latency() const noexcept
+  {
+    return m_limiter ? limiter_lookahead() : 0;
+  }
+
+  // Voices are playing, or the limiter still holds some of their output
+  bool sounding() const noexcept
+  {
+    if (m_voices.count > 0)
+      return true;
+    if (m_limiter)
+      for (const auto& l : m_limiters)
+        if (!l.idle())
+          return true;
+    return false;
+  }
+
+  int limiter_lookahead() const noexcept
+  {
+    return std::min<int>(
+        std::clamp(m_lookahead, 0., max_lookahead_seconds) * m_sampleRate,
+        max_lookahead_frames);
+  }
+
+  // Limits the buses this block wrote to, and the ones whose limiter still
+  // has something in its delay line.
+  void apply_limiter(int64_t first_pos, int64_t frames) noexcept
+  {
+    if (!m_limiter)
+    {
+      m_limiterRunning = false;
+      return;
+    }
+    if (!m_limiterRunning)
+    {
+      // What was left in the delay lines when the limiter was turned off
+      // is not played anymore
+      for (auto& l : m_limiters)
+        l.reset();
+      m_limiterRunning = true;
+    }
+
+    const int lookahead = limiter_lookahead();
+    const float release
+        = 1. - std::exp(-1. / (limiter_release * m_sampleRate));
+    const std::size_t channels = output_channels();
+    for (int b = 0; b < max_buses; b++)
+    {
+      auto& limiter = m_limiters[b];
+      if (!(m_usedBuses & (1u << b)) && limiter.idle())
+        continue;
+
+      auto& port = bus_port(b);
+      port.set_channels(std::max(port.channels(), channels));
+      m_limiterPointers.clear();
+      for (auto& c : port.get())
+      {
+        c.resize(std::max<std::size_t>(c.size(), first_pos + frames));
+        m_limiterPointers.push_back(c.data() + first_pos);
+      }
+
+      limiter.prepare(lookahead);
+      limiter.process(
+          m_limiterPointers.data(),
+          m_limiterPointers.size(),
+          frames,
+          m_ceiling,
+          release);
+    }
+  }
+
+  // Boundaries of the segments of the buffer [first; end): the start, and
+  // the timestamps of the MIDI messages and control values. Past
+  // max_block_splits, events are applied at the start of the segment
+  // they fall in.
+  void split_buffer(int64_t first, int64_t end) noexcept
+  {
+    m_splits.clear();
+    m_splits.push_back(first);
+    const auto add = [&](int64_t timestamp)
+    {
+      if (m_splits.size() < m_splits.capacity())
+        m_splits.push_back(std::clamp(timestamp, first, end - 1));
+    };
+
+    for (const libremidi::message& m : in->messages)
+      add(m.timestamp);
+    auto& inputs = this->root_inputs();
+    for (std::size_t i = 1; i < inputs.size(); i++)
+      if (auto port = inputs[i]->target<ossia::value_port>())
+        for (const auto& v : port->get_data())
+          add(v.timestamp);
+
+    std::sort(m_splits.begin(), m_splits.end());
+    m_splits.erase(
+        std::unique(m_splits.begin(), m_splits.end()), m_splits.end());
+  }
+
+  // Renders `frames` frames at `pos` in the output buffers.
+  // Returns whether any voice was playing.
+  bool render_segment(
+      const ossia::token_request& tk,
+      ossia::exec_state_facade s,
+      int64_t pos,
+      int64_t frames)
+  {
+    const double smoothing
+        = std::min(1., double(frames) / (pitch_smoothing * s.sampleRate()));
+    update_pitch(smoothing);
+    update_sync(tk, smoothing);
+
+    if (m_voices.count == 0)
+    {
+      m_prevGain = mix_gain();
+      return false;
+    }
+    m_mixGain = mix_gain();
+
+    // Make sure we have enough space. The buses which no voice plays on
+    // are left untouched.
+    const std::size_t channels = output_channels();
+    unsigned used_buses = 1;
+    for (int i = 0; i < m_voices.count; i++)
+      used_buses |= 1u << m_voices.bus[i];
+    m_usedBuses |= used_buses;
+    for (int b = 0; b < max_buses; b++)
+    {
+      if (!(used_buses & (1u << b)))
+        continue;
+      auto& port = bus_port(b);
+      port.set_channels(std::max(port.channels(), channels));
+      for (auto& out_channel : port.get())
+      {
+        out_channel.resize(
+            std::max(out_channel.size(), std::size_t(s.bufferSize())));
+      }
+    }
+
+    // Play all our voices
+    for (int i = 0; i < m_voices.count; i++)
+    {
+      render_voice(s, i, frames);
+    }
+    if (m_grains.count > 0)
+      render_grains(frames);
+
+    if (m_filterMode != filter_mode::Off)
+    {
+      update_filter(frames);
+      switch (m_filterMode)
+      {
+        case filter_mode::LowPass:
+          filter_voices<filter_mode::LowPass>(frames);
+          break;
+        case filter_mode::HighPass:
+          filter_voices<filter_mode::HighPass>(frames);
+          break;
+        case filter_mode::BandPass:
+          filter_voices<filter_mode::BandPass>(frames);
+          break;
+        default:
+          break;
+      }
+    }
+
+    for (int i = 0; i < m_voices.count; i++)
+    {
+      mix_voice(i, pos, frames);
+    }
+    m_prevGain = m_mixGain;
+
+    retire_finished_voices();
+    return true;
+  }
+
+  void
+  run(const ossia::token_request& tk,
+      ossia::exec_state_facade s) noexcept override
+  {
+    const scoped_flush_denormals flush;
+
+    using clock = std::chrono::steady_clock;
+    const auto start_time
+        = m_measureFirstSample ? clock::now() : clock::time_point{};
+
+    m_sampleRate = s.sampleRate();
+    m_bufferSize = s.bufferSize();
+
+    const auto [first_pos, tick_duration] = s.timings(tk);
+    // Date of the start of the block in the process: MIDI timestamps are
+    // relative to the buffer, which may start before the process
+    const int64_t date = tk.prev_date.impl * s.modelToSamples();
+    capture_midi(date - first_pos);
+
+    m_window = {};
+    if (m_frozen && m_frozenRate == m_sampleRate)
+    {
+      process_controls();
+      if (tick_duration > 0)
+        play_frozen(date, first_pos, tick_duration);
+      return;
+    }
+
+    apply_chokes();
+    release_unused_sounds();
+    m_usedBuses = 0;
+    if (tick_duration <= 0
+        || (m_sounds[m_current].channels == 0 && m_voices.count == 0))
+    {
+      process_controls();
+      process_midi();
+      if (tick_duration > 0)
+        apply_limiter(first_pos, tick_duration);
+      return;
+    }
+
+    // The buffer is rendered in segments which start at each timestamped
+    // MIDI message or control value, so that they apply at their frame.
+    const int64_t end = first_pos + tick_duration;
+    split_buffer(first_pos, end);
+    bool played = false;
+    for (std::size_t k = 0; k < m_splits.size(); k++)
+    {
+      const int64_t begin = m_splits[k];
+      const int64_t segment_end
+          = k + 1 < m_splits.size() ? m_splits[k + 1] : end;
+      m_window = {begin, segment_end, first_pos, end - 1};
+
+      process_controls();
+      if (m_prevGain < 0.)
+        m_prevGain = mix_gain();
+      process_midi();
+      played |= render_segment(tk, s, begin, segment_end - begin);
+    }
+    m_window = {};
+    apply_limiter(first_pos, tick_duration);
+
+    if (m_measureFirstSample && played)
+    {
+      using namespace std::chrono;
+      m_timeToFirstSample
+          = duration_cast<nanoseconds>(clock::now() - start_time).count();
+      m_measureFirstSample = false;
+    }
+  }
+
+  std::string label() const noexcept override { return "samplette"; }
+
+  ossia::midi_inlet in;
+
+  ossia::value_inlet trigger_mode;
+  ossia::value_inlet poly_mode;
+  ossia::value_inlet root;
+
+  ossia::value_inlet gain;
+
+  ossia::value_inlet start;
+  ossia::value_inlet length;
+
+  ossia::value_inlet loops;
+  ossia::value_inlet loop_start;
+
+  ossia::value_inlet pitch;
+
+  ossia::value_inlet attack;
+  ossia::value_inlet decay;
+  ossia::value_inlet sustain;
+  ossia::value_inlet release;
+
+  ossia::value_inlet velocity;
+  ossia::value_inlet fade;
+
+  ossia::value_inlet snap;
+  ossia::value_inlet gate_ramp;
+  ossia::value_inlet bend_range;
+  ossia::value_inlet mpe;
+  ossia::value_inlet engine;
+
+  ossia::value_inlet filter;
+  ossia::value_inlet cutoff;
+  ossia::value_inlet resonance;
+  ossia::value_inlet filter_env;
+  ossia::value_inlet filter_attack;
+  ossia::value_inlet filter_decay;
+  ossia::value_inlet key_track;
+  ossia::value_inlet filter_velocity;
+  ossia::value_inlet choke_group;
+
+  ossia::value_inlet sync;
+  ossia::value_inlet bpm;
+  ossia::value_inlet beats;
+
+  // The model builds the sample store for the chosen storage and it comes
+  // with the sound: this inlet is only there to keep the order of the
+  // controls.
+  ossia::value_inlet storage;
+
+  ossia::value_inlet outputs;
+  ossia::value_inlet pan;
+  ossia::value_inlet spread;
+  ossia::value_inlet pan_key_track;
+  ossia::value_inlet pan_velocity;
+  ossia::value_inlet pan_random;
+
+  ossia::value_inlet zones;
+
+  ossia::value_inlet limiter;
+  ossia::value_inlet ceiling;
+  ossia::value_inlet lookahead;
+  ossia::value_inlet auto_gain;
+
+  ossia::value_inlet grain_size;
+  ossia::value_inlet grain_density;
+  ossia::value_inlet grain_position;
+  ossia::value_inlet grain_jitter;
+  ossia::value_inlet grain_shape;
+
+  ossia::value_inlet direction;
+  ossia::value_inlet key_map;
+
+  ossia::audio_outlet out;
+  std::array<ossia::audio_outlet, max_buses - 1> bus_out;
+
+  ossia::audio_port& bus_port(int bus) noexcept
+  {
+    return bus == 0 ? *out : *bus_out[bus - 1];
+  }
+
+  // Stretch is not user-selectable: it is used by all the voices started
+  // in sync mode.
+  enum Engine
+  {
+    Sinc,
+    Linear,
+    Granular,
+    Stretch
+  } m_engine{};
+
+  static Engine engine_from_string(const std::string& str) noexcept
+  {
+    if (str == "Linear")
+      return Linear;
+    else if (str == "Granular")
+      return Granular;
+    return Sinc;
+  }
+
+  static constexpr const RubberBand::RubberBandStretcher::Options
+      stretcher_options{
+          RubberBand::RubberBandStretcher::OptionProcessRealTime
+          | RubberBand::RubberBandStretcher::OptionPitchHighConsistency};
+
+  // Per-voice state of the engines which is too heavy to be moved around,
+  // indexed by voice_bank::slot. What they allocate is in voice_resources.
+  struct voice_engine
+  {
+    ossia::token_request timing;
+    double pitch_scale{1.};
+    Engine engine{};
+    // Frames until the next grain starts
+    int64_t next_grain{};
+    // Gain of each source channel in each output, see compute_pan_gains
+    std::array<float, max_output_channels * max_filter_channels> pan_gains{};
+  };
+
+  voice_bank m_voices;
+  std::array<voice_engine, max_voices> m_engines;
+  std::array<int16_t, max_voices> m_freeSlots{};
+  int m_freeCount{};
+  uint64_t m_voiceCounter{};
+
+  // Voices which are still held, indexed by voice_key(channel, note)
+  std::array<int16_t, 16 * 128> m_noteVoices{};
+
+  // Scratch buffers for the block renderer
+  static constexpr const std::size_t max_block_splits{256};
+  std::vector<int64_t> m_splits;
+  event_window m_window;
+  // Gain curve of a voice, rendered by chunks of envelope_chunk frames
+  static constexpr const int envelope_chunk{256};
+  std::vector<float> m_envelope;
+  std::vector<double*> m_channelPointers;
+  static constexpr const int filter_chunk{64};
+  std::array<float, filter_chunk * max_voices> m_filterScratch{};
+
+  // Last per-note expression values received on each channel.
+  // Pressure defaults to the maximum so that controllers which do not send
+  // it are still heard.
+  std::array<float, 16> m_channelBend{};
+  std::array<float, 16> m_channelPressure{
+      1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f,
+      1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f};
+  std::array<float, 16> m_channelTimbre{
+      .5f, .5f, .5f, .5f, .5f, .5f, .5f, .5f,
+      .5f, .5f, .5f, .5f, .5f, .5f, .5f, .5f};
+
+  // MPE lower zone: channel 1 carries the global messages and the default
+  // per-note pitch bend range is 48 semitones.
+  bool m_mpe{false};
+  static constexpr const int mpe_master_channel{0};
+  static constexpr const float mpe_bend_range{4800.f};
+
+  // Sounds the voices play, see sound_source
+  std::array<sound_source, max_sounds> m_sounds;
+  int m_current{};
+
+  // Sound given while every slot was played
+  std::shared_ptr<prepared_sound> m_pendingSound;
+
+  // What the audio thread releases is freed by reclaim_released
+  static constexpr const std::size_t max_reclaimed{64};
+  reclaim_queue<max_reclaimed> m_reclaim;
+
+  // Prewarming: seconds of the region head kept in memory, and the
+  // time it took to render the first block with voices after set_sound,
+  // in nanoseconds, or -1.
+  static constexpr const double prewarm_seconds{2.};
+  static constexpr const std::size_t prewarm_buffer_size{4096};
+  int64_t m_timeToFirstSample{-1};
+  bool m_measureFirstSample{false};
+
+  // Scratch for the compressed copies, decoded on the fly
+  static constexpr const int64_t decode_cache_frames{16384};
+  std::vector<std::vector<float>> m_decodeCache;
+  std::vector<float*> m_cachePointers;
+  std::shared_ptr<const sample_analysis> m_analysis;
+
+  double m_sampleRate{44100.};
+  int m_bufferSize{};
+
+  // Freeze
+  static constexpr const std::size_t max_captured_events{1 << 16};
+  std::vector<midi_event> m_capture;
+  ossia::audio_handle m_frozen;
+  int m_frozenRate{};
+
+  enum
+  {
+    Trigger,
+    Gate
+  } m_triggerMode{};
+  enum
+  {
+    Mono,
+    Poly
+  } m_polyMode{};
+
+  int m_root{60};
+
+  double m_gain{1.};
+  // Gain at the end of the last segment, which the next one ramps from.
+  // Negative until the first segment.
+  double m_prevGain{-1.};
+  // Gain the current segment ramps to, see mix_gain
+  double m_mixGain{1.};
+  bool m_autoGain{false};
+
+  bool m_loops{false};
+
+  // The three values below in percentages
+  double m_start{0.};
+  double m_length{1.};
+  double m_loopStart{0.};
+  //double m_loopEnd{1.};
+  bool m_snap{false};
+
+  // Semitones
+  double m_userPitchShift{0.};
+  double m_bendRange{2.};
+  // Last pitch bend, in [-1; 1]
+  double m_midiPitchBend{0.};
+
+  // Smoothed pitch modulation in cents, and its time constant in seconds
+  double m_pitchCents{0.};
+  static constexpr const double pitch_smoothing{0.01};
+
+  double m_attack{0.};
+  double m_decay{1.};
+  double m_sustainGain{1.};
+  double m_release{0.};
+
+  double m_velocity{};
+  double m_fade{};
+
+  // Anti-click ramp applied when a voice is cut, in seconds
+  double m_gateRamp{0.005};
+
+  // About -96 dB: under it, voices and parts of the sample are considered
+  // silent. Releasing voices are only retired once their envelope is
+  // under release_floor (-60 dB), so that a quiet part of the sample does
+  // not cut a release which is still heard.
+  static constexpr const float silence_level{1.6e-5f};
+  static constexpr const double release_floor{0.001};
+
+  bool m_sustainPedal{false};
+  bool m_sostenutoPedal{false};
+
+  // 0 means no choke group. m_chokeSeen is the last value of each group's
+  // counter this node knows of.
+  int m_chokeGroup{0};
+  std::shared_ptr<choke_bus> m_chokeBus;
+  std::array<uint64_t, max_choke_groups + 1> m_chokeSeen{};
+
+  // Tempo sync: the native tempo of the sample in BPM, or its length in
+  // beats when non-zero, and the smoothed playback speed it gives.
+  bool m_sync{false};
+  double m_nativeTempo{120.};
+  int m_beats{0};
+  double m_syncSpeed{1.};
+
+  filter_mode m_filterMode{filter_mode::Off};
+  // Hz
+  double m_cutoff{20000.};
+  // In [0; 1]
+  double m_resonance{0.};
+  // Octaves
+  double m_filterEnv{0.};
+  double m_filterVelocity{0.};
+  // Seconds
+  double m_filterAttack{0.};
+  double m_filterDecay{0.5};
+  // In [0; 1], 1 means the cutoff follows the notes
+  double m_keyTrack{0.};
+
+  // Panning, in [-1; 1] pan units. The random part is drawn at each note
+  // from a fixed seed so that renders are reproducible.
+  output_layout m_outputLayout{output_layout::Source};
+  speaker_layout m_speakers{};
+  double m_pan{0.};
+  double m_spread{1.};
+  double m_panKeyTrack{0.};
+  double m_panVelocity{0.};
+  double m_panRandom{0.};
+  uint32_t m_randomState{0x9E3779B9u};
+
+  // Zones: output bus and choke group of each note
+  zone_map m_zones{};
+  // Key samples of a multisample, read at note on
+  multisample m_keyMap{parse_multisample({})};
+
+  // Output limiter, one per bus. The ceiling is a linear gain and the
+  // lookahead is in seconds, as is the release.
+  bool m_limiter{false};
+  double m_ceiling{db_to_gain(-0.3)};
+  double m_lookahead{0.002};
+  static constexpr const double limiter_release{0.05};
+  std::array<lookahead_limiter, max_buses> m_limiters;
+  std::vector<double*> m_limiterPointers;
+  // False while the limiter is off, so that it starts from a clean state
+  bool m_limiterRunning{false};
+  // Buses written to in the current block
+  unsigned m_usedBuses{};
+
+  // Granular engine. The size is in seconds, the density in grains per
+  // second and per voice, the position and jitter in [0; 1] of the
+  // region.
+  grain_pool m_grains;
+  grain_windows m_grainWindows;
+  double m_grainSize{0.05};
+  double m_grainDensity{20.};
+  double m_grainPosition{0.};
+  double m_grainJitter{0.};
+  grain_window m_grainWindow{};
+  uint32_t m_grainRandom{0x2545F491u};
+
+  // Direction of the next voices; m_nextReverse is the one the next note
+  // gets when alternating.
+  play_direction m_direction{play_direction::Forward};
+  bool m_nextReverse{false};
+};
+}
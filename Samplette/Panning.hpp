@@ -0,0 +1,166 @@
+#pragma once
+#include <Samplette/Voices.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <string>
+
+namespace Samplette
+{
+static constexpr const int max_output_channels{8};
+
+// Speaker layouts of the output. Source keeps the channels of the sample
+// as they are, without panning.
+enum class output_layout
+{
+  Source,
+  Mono,
+  Stereo,
+  Quad,
+  Surround51,
+  Surround71,
+  Octagon
+};
+
+inline output_layout output_layout_from_string(const std::string& str) noexcept
+{
+  if (str == "Mono")
+    return output_layout::Mono;
+  else if (str == "Stereo")
+    return output_layout::Stereo;
+  else if (str == "Quad")
+    return output_layout::Quad;
+  else if (str == "5.1")
+    return output_layout::Surround51;
+  else if (str == "7.1")
+    return output_layout::Surround71;
+  else if (str == "Octagon")
+    return output_layout::Octagon;
+  return output_layout::Source;
+}
+
+// Azimuth of each output channel in degrees, clockwise from the front.
+// The LFE channel is NaN: it is never panned to.
+struct speaker_layout
+{
+  int channels{};
+  // Whether the speakers surround the listener: pan then goes around the
+  // circle, [-1; 1] mapping to [-180; 180] degrees, instead of going from
+  // the leftmost to the rightmost speaker.
+  bool ring{};
+  std::array<float, max_output_channels> azimuth{};
+};
+
+inline speaker_layout make_speaker_layout(output_layout l) noexcept
+{
+  constexpr float lfe = NAN;
+  switch (l)
+  {
+    case output_layout::Mono:
+      return {1, false, {0.f}};
+    case output_layout::Stereo:
+      return {2, false, {-30.f, 30.f}};
+    case output_layout::Quad:
+      return {4, true, {-45.f, 45.f, -135.f, 135.f}};
+    case output_layout::Surround51:
+      return {6, true, {-30.f, 30.f, 0.f, lfe, -110.f, 110.f}};
+    case output_layout::Surround71:
+      return {8, true, {-30.f, 30.f, 0.f, lfe, -90.f, 90.f, -150.f, 150.f}};
+    case output_layout::Octagon:
+      return {
+          8, true, {0.f, 45.f, 90.f, 135.f, 180.f, -135.f, -90.f, -45.f}};
+    case output_layout::Source:
+      break;
+  }
+  return {};
+}
+
+// Constant-power panning between the two speakers adjacent to the pan
+// position, for each channel of the source. The channels of the source
+// are spread around the pan position: with a spread of 1 they go from the
+// leftmost to the rightmost speaker, or evenly around the circle.
+// gains is laid out as [output][source], with a stride of
+// max_filter_channels.
+inline void compute_pan_gains(
+    const speaker_layout& layout,
+    int sources,
+    float pan,
+    float spread,
+    float* gains) noexcept
+{
+  std::fill_n(gains, max_output_channels * max_filter_channels, 0.f);
+  if (layout.channels == 0 || sources == 0)
+    return;
+
+  // Speakers in increasing azimuth, by insertion
+  std::array<int, max_output_channels> order{};
+  int speakers = 0;
+  for (int o = 0; o < layout.channels; o++)
+  {
+    if (std::isnan(layout.azimuth[o]))
+      continue;
+    int k = speakers++;
+    for (; k > 0 && layout.azimuth[order[k - 1]] > layout.azimuth[o]; k--)
+      order[k] = order[k - 1];
+    order[k] = o;
+  }
+
+  for (int c = 0; c < sources; c++)
+  {
+    float p = pan;
+    if (sources > 1)
+    {
+      const float offset = 2.f * c / (sources - 1) - 1.f;
+      p += spread * offset * (layout.ring ? (sources - 1.f) / sources : 1.f);
+    }
+
+    if (speakers == 1)
+    {
+      gains[order[0] * max_filter_channels + c] = 1.f;
+      continue;
+    }
+
+    const float first = layout.azimuth[order[0]];
+    const float last = layout.azimuth[order[speakers - 1]];
+    float az{};
+    if (layout.ring)
+    {
+      az = 180.f * (p - 2.f * std::floor((p + 1.f) / 2.f));
+      if (az < first)
+        az += 360.f;
+    }
+    else
+    {
+      az = std::clamp(first + (p + 1.f) / 2.f * (last - first), first, last);
+    }
+
+    // In a ring the last pair goes from the last speaker to the first one
+    int k = 0;
+    while (k < speakers - 1 && az > layout.azimuth[order[k + 1]])
+      k++;
+    const bool wraps = k == speakers - 1;
+    const int a = order[k];
+    const int b = order[wraps ? 0 : k + 1];
+    const float az_a = layout.azimuth[a];
+    const float az_b = layout.azimuth[b] + (wraps ? 360.f : 0.f);
+    const float t = az_b > az_a ? (az - az_a) / (az_b - az_a) : 0.f;
+
+    gains[a * max_filter_channels + c]
+        += std::cos(t * std::numbers::pi_v<float> / 2.f);
+    gains[b * max_filter_channels + c]
+        += std::sin(t * std::numbers::pi_v<float> / 2.f);
+  }
+}
+
+// Uniform in [-1; 1), xorshift32: cheap and reproducible between renders
+[[nodiscard]] inline float next_random(uint32_t& state) noexcept
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state * (2.f / 4294967296.f) - 1.f;
+}
+}
@@ -1,11 +1,23 @@
 #include <score/command/Dispatchers/CommandDispatcher.hpp>
 
+#include <Samplette/BatchImport.hpp>
 #include <Samplette/CommandFactory.hpp>
 #include <Samplette/Presenter.hpp>
 #include <Samplette/Process.hpp>
 #include <Samplette/View.hpp>
 
 #include <Media/Sound/Drop/SoundDrop.hpp>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QMimeData>
+#include <QProgressDialog>
+#include <QStandardPaths>
+#include <QUrl>
+#include <QUuid>
+
+#include <algorithm>
+
 namespace Samplette
 {
 Presenter::Presenter(
@@ -20,6 +32,11 @@ Presenter::Presenter(
   connect(view, &View::dropReceived, this, &Presenter::on_drop);
 }
 
+Presenter::~Presenter()
+{
+  cancelImport();
+}
+
 void Presenter::setWidth(qreal val, qreal defaultWidth)
 {
   m_view->setWidth(val);
@@ -48,6 +65,33 @@ void Presenter::on_zoomRatioChanged(ZoomRatio z)
 
 void Presenter::on_drop(const QMimeData* mime)
 {
+  auto& model = static_cast<const Model&>(m_process);
+  if (mime->hasUrls())
+  {
+    const auto urls = mime->urls();
+    if (urls.size() == 1 && urls.front().isLocalFile()
+        && QFileInfo{urls.front().toLocalFile()}.suffix() == kit_extension)
+    {
+      loadKit(context().context, model, urls.front().toLocalFile());
+      return;
+    }
+
+    // The kit is named after the dropped folder, or the one of the files
+    const bool folder = std::any_of(
+        urls.begin(),
+        urls.end(),
+        [](const QUrl& url)
+        { return url.isLocalFile() && QFileInfo{url.toLocalFile()}.isDir(); });
+    if (folder || urls.size() > 1)
+    {
+      const QFileInfo first{urls.front().toLocalFile()};
+      importSamples(
+          sample_files(urls),
+          first.isDir() ? first.fileName() : first.dir().dirName());
+      return;
+    }
+  }
+
   Media::Sound::DroppedAudioFiles drops{context().context, *mime};
   if (!drops.valid() || drops.files.size() != 1)
   {
@@ -56,8 +100,72 @@ void Presenter::on_drop(const QMimeData* mime)
 
   CommandDispatcher<> disp{context().context.commandStack};
   disp.submit<ChangeAudioFile>(
-      static_cast<const Model&>(m_process),
-      std::move(drops.files.front().first));
+      model, std::move(drops.files.front().first));
+}
+
+void Presenter::importSamples(const QStringList& files, const QString& name)
+{
+  cancelImport();
+  if (files.isEmpty())
+    return;
+
+  // Saved with the cache like the frozen renders
+  const auto dir = QStandardPaths::writableLocation(
+                       QStandardPaths::CacheLocation)
+                   + "/samplette";
+  QDir{}.mkpath(dir);
+  const auto path = dir + "/"
+                    + QUuid::createUuid().toString(QUuid::WithoutBraces) + "."
+                    + kit_extension;
+
+  // Only shown if the import takes a while
+  auto progress = new QProgressDialog{
+      tr("Importing %1...").arg(name), tr("Cancel"), 0, int(files.size())};
+  progress->setMinimumDuration(500);
+  progress->setAutoClose(false);
+  connect(
+      progress, &QProgressDialog::canceled, this, &Presenter::cancelImport);
+  m_progress = progress;
+
+  const int id = ++m_importCount;
+  QPointer<Presenter> self{this};
+  m_import = batch_import::start(
+      files,
+      name,
+      path,
+      [self, id](int decoded, int)
+      {
+        if (self && self->m_importCount == id && self->m_progress)
+          self->m_progress->setValue(decoded);
+      },
+      [self, id, path](std::shared_ptr<const kit> bundle)
+      {
+        if (!self || self->m_importCount != id)
+          return;
+
+        self->cancelImport();
+        if (bundle)
+          importKit(
+              self->context().context,
+              self->m_model,
+              path,
+              std::move(bundle));
+      });
+}
+
+void Presenter::cancelImport()
+{
+  ++m_importCount;
+  if (m_import)
+  {
+    m_import->cancel();
+    m_import.reset();
+  }
+  if (m_progress)
+  {
+    m_progress->deleteLater();
+    m_progress.clear();
+  }
 }
 
 void Presenter::parentGeometryChanged()
@@ -5,10 +5,16 @@
 
 #include <score/model/Identifier.hpp>
 
+#include <QPointer>
+
+#include <memory>
+
+class QProgressDialog;
 namespace Samplette
 {
 class Model;
 class View;
+class batch_import;
 class Presenter final : public Process::LayerPresenter
 {
 public:
@@ -17,6 +23,7 @@ public:
       View* view,
       const Process::Context& ctx,
       QObject* parent);
+  ~Presenter() override;
 
   void setWidth(qreal width, qreal defaultWidth) override;
   void setHeight(qreal height) override;
@@ -30,7 +37,17 @@ public:
   void parentGeometryChanged() override;
 
 private:
+  // Several files or folders are imported as a multisample, one batch at a
+  // time: a new drop cancels the import in progress.
+  void importSamples(const QStringList& files, const QString& name);
+  void cancelImport();
+
   const Model& m_model;
   View* m_view{};
+
+  std::shared_ptr<batch_import> m_import;
+  QPointer<QProgressDialog> m_progress;
+  // Callbacks of cancelled imports are ignored
+  int m_importCount{};
 };
 }
@@ -0,0 +1,144 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#if __has_include(<sys/mman.h>) && __has_include(<unistd.h>)
+#include <sys/mman.h>
+#include <unistd.h>
+#define SAMPLETTE_HAS_MLOCK 1
+#endif
+
+namespace Samplette
+{
+static constexpr const std::size_t page_size_hint{4096};
+
+// Reads one value per page so that the pages are faulted in now rather
+// than when a voice first reaches them.
+inline void touch_pages(const void* data, std::size_t bytes) noexcept
+{
+  auto p = static_cast<const volatile unsigned char*>(data);
+  unsigned char sum = 0;
+  for (std::size_t i = 0; i < bytes; i += page_size_hint)
+    sum += p[i];
+  if (bytes > 0)
+    sum += p[bytes - 1];
+  (void)sum;
+}
+
+#if defined(SAMPLETTE_HAS_MLOCK)
+// mlock does not nest: the pages locked by all the page_locks are counted
+// here, and only the last lock of a page unlocks it, e.g. when the sound
+// prepared again for a sync change locks the same heads as the previous
+// one before it is freed.
+class locked_pages
+{
+public:
+  static locked_pages& instance()
+  {
+    static locked_pages pages;
+    return pages;
+  }
+
+  static std::size_t page_size() noexcept
+  {
+    static const std::size_t page = sysconf(_SC_PAGESIZE);
+    return page;
+  }
+
+  void lock(uintptr_t begin, uintptr_t end)
+  {
+    std::lock_guard _{m_mutex};
+    apply(begin, end, [](int& count) { return count++ == 0; }, ::mlock);
+  }
+
+  void unlock(uintptr_t begin, uintptr_t end)
+  {
+    std::lock_guard _{m_mutex};
+    apply(begin, end, [](int& count) { return --count == 0; }, ::munlock);
+    for (auto p = begin; p < end; p += page_size())
+      if (auto it = m_counts.find(p); it != m_counts.end() && it->second == 0)
+        m_counts.erase(it);
+  }
+
+private:
+  // Calls `call` once per run of pages for which `change` returns true
+  template <typename Change, typename Call>
+  void apply(uintptr_t begin, uintptr_t end, Change change, Call call)
+  {
+    const std::size_t page = page_size();
+    uintptr_t run = 0;
+    for (auto p = begin; p < end; p += page)
+    {
+      if (change(m_counts[p]))
+      {
+        if (!run)
+          run = p;
+      }
+      else if (run)
+      {
+        call(reinterpret_cast<void*>(run), p - run);
+        run = 0;
+      }
+    }
+    if (run)
+      call(reinterpret_cast<void*>(run), end - run);
+  }
+
+  std::mutex m_mutex;
+  std::map<uintptr_t, int> m_counts;
+};
+#endif
+
+// Keeps a few ranges of memory locked, e.g. the heads of the channels of
+// the sample. Locking is best-effort: it fails silently if the system
+// does not allow it. Ranges may overlap those of other page_locks.
+// Neither locking nor unlocking is meant for the audio thread.
+class page_locks
+{
+public:
+  page_locks() = default;
+  page_locks(const page_locks&) = delete;
+  page_locks& operator=(const page_locks&) = delete;
+  ~page_locks() { unlock_all(); }
+
+  void lock(const void* data, std::size_t bytes)
+  {
+#if defined(SAMPLETTE_HAS_MLOCK)
+    if (m_count == m_ranges.size() || bytes == 0)
+      return;
+
+    // mlock works on whole pages
+    const std::size_t page = locked_pages::page_size();
+    const auto begin = reinterpret_cast<uintptr_t>(data) & ~(page - 1);
+    const auto end
+        = (reinterpret_cast<uintptr_t>(data) + bytes + page - 1) & ~(page - 1);
+    locked_pages::instance().lock(begin, end);
+    m_ranges[m_count++] = {begin, end};
+#else
+    (void)data;
+    (void)bytes;
+#endif
+  }
+
+  void unlock_all()
+  {
+#if defined(SAMPLETTE_HAS_MLOCK)
+    for (std::size_t i = 0; i < m_count; i++)
+      locked_pages::instance().unlock(m_ranges[i].begin, m_ranges[i].end);
+#endif
+    m_count = 0;
+  }
+
+private:
+  struct range
+  {
+    uintptr_t begin{};
+    uintptr_t end{};
+  };
+  std::array<range, 16> m_ranges{};
+  std::size_t m_count{};
+};
+}
@@ -6,7 +6,21 @@
 #include <Process/Dataflow/PortSerialization.hpp>
 
 #include <score/application/GUIApplicationContext.hpp>
+#include <score/command/Dispatchers/CommandDispatcher.hpp>
+#include <score/document/DocumentContext.hpp>
 #include <score/tools/File.hpp>
+#include <score/tools/std/Invoke.hpp>
+
+#include <Samplette/CommandFactory.hpp>
+#include <Samplette/Limiter.hpp>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QPointer>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QUuid>
 
 #include <wobjectimpl.h>
 
@@ -125,15 +139,236 @@ Model::Model(
           Id<Process::Port>(15),
           this)}
 
+    , snap{new Process::Toggle(false, "Snap", Id<Process::Port>(16), this)}
+    , gate_ramp{new Process::FloatKnob(
+          0,
+          100,
+          5,
+          "Gate ramp",
+          Id<Process::Port>(17),
+          this)}
+    , bend_range{new Process::IntSlider(
+          0,
+          48,
+          2,
+          "Bend range",
+          Id<Process::Port>(18),
+          this)}
+    , mpe{new Process::Toggle(false, "MPE", Id<Process::Port>(19), this)}
+    , engine{new Process::Enum(
+          QStringList{"Sinc", "Linear", "Granular"},
+          {},
+          "Sinc",
+          "Engine",
+          Id<Process::Port>(20),
+          this)}
+
+    , filter{new Process::Enum(
+          QStringList{"Off", "Low-pass", "High-pass", "Band-pass"},
+          {},
+          "Off",
+          "Filter",
+          Id<Process::Port>(21),
+          this)}
+    , cutoff{new Process::LogFloatSlider(
+          20,
+          20000,
+          20000,
+          "Cutoff",
+          Id<Process::Port>(22),
+          this)}
+    , resonance{new Process::FloatKnob(
+          0,
+          1,
+          0,
+          "Resonance",
+          Id<Process::Port>(23),
+          this)}
+    , filter_env{new Process::FloatKnob(
+          -8,
+          8,
+          0,
+          "Filter env",
+          Id<Process::Port>(24),
+          this)}
+    , filter_attack{new Process::LogFloatSlider(
+          0,
+          20000,
+          0,
+          "Filter attack",
+          Id<Process::Port>(25),
+          this)}
+    , filter_decay{new Process::LogFloatSlider(
+          1,
+          60000,
+          500,
+          "Filter decay",
+          Id<Process::Port>(26),
+          this)}
+    , key_track{new Process::FloatKnob(
+          0,
+          100,
+          0,
+          "Key track",
+          Id<Process::Port>(27),
+          this)}
+    , filter_velocity{new Process::FloatKnob(
+          0,
+          8,
+          0,
+          "Filter velocity",
+          Id<Process::Port>(28),
+          this)}
+
+    , choke_group{new Process::IntSlider(
+          0,
+          32,
+          0,
+          "Choke group",
+          Id<Process::Port>(29),
+          this)}
+
+    , sync{new Process::Toggle(false, "Sync", Id<Process::Port>(30), this)}
+    , bpm{new Process::FloatSlider(
+          20,
+          300,
+          120,
+          "BPM",
+          Id<Process::Port>(31),
+          this)}
+    , beats{new Process::IntSlider(
+          0,
+          256,
+          0,
+          "Beats",
+          Id<Process::Port>(32),
+          this)}
+
+    , storage{new Process::Enum(
+          QStringList{"Float", "16-bit", "24-bit", "Packed"},
+          {},
+          "Float",
+          "Storage",
+          Id<Process::Port>(33),
+          this)}
+
+    , outputs{new Process::Enum(
+          QStringList{
+              "Source", "Mono", "Stereo", "Quad", "5.1", "7.1", "Octagon"},
+          {},
+          "Source",
+          "Outputs",
+          Id<Process::Port>(34),
+          this)}
+    , pan{new Process::FloatKnob(-1, 1, 0, "Pan", Id<Process::Port>(35), this)}
+    , spread{new Process::FloatKnob(
+          0,
+          1,
+          1,
+          "Spread",
+          Id<Process::Port>(36),
+          this)}
+    , pan_key_track{new Process::FloatKnob(
+          -1,
+          1,
+          0,
+          "Pan key track",
+          Id<Process::Port>(37),
+          this)}
+    , pan_velocity{new Process::FloatKnob(
+          -1,
+          1,
+          0,
+          "Pan velocity",
+          Id<Process::Port>(38),
+          this)}
+    , pan_random{new Process::FloatKnob(
+          0,
+          1,
+          0,
+          "Pan random",
+          Id<Process::Port>(39),
+          this)}
+
+    , zones{new Process::LineEdit("", "Zones", Id<Process::Port>(40), this)}
+
+    , limiter{
+          new Process::Toggle(false, "Limiter", Id<Process::Port>(41), this)}
+    , ceiling{new Process::FloatSlider(
+          -24,
+          0,
+          -0.3,
+          "Ceiling",
+          Id<Process::Port>(42),
+          this)}
+    , lookahead{new Process::FloatSlider(
+          0,
+          10,
+          2,
+          "Lookahead",
+          Id<Process::Port>(43),
+          this)}
+    , auto_gain{
+          new Process::Toggle(false, "Auto gain", Id<Process::Port>(44), this)}
+
+    , grain_size{new Process::FloatSlider(
+          1,
+          500,
+          50,
+          "Grain size",
+          Id<Process::Port>(45),
+          this)}
+    , grain_density{new Process::FloatSlider(
+          1,
+          500,
+          20,
+          "Grain density",
+          Id<Process::Port>(46),
+          this)}
+    , grain_position{new Process::FloatSlider(
+          0,
+          100,
+          0,
+          "Grain position",
+          Id<Process::Port>(47),
+          this)}
+    , grain_jitter{new Process::FloatSlider(
+          0,
+          100,
+          0,
+          "Grain jitter",
+          Id<Process::Port>(48),
+          this)}
+    , grain_shape{new Process::Enum(
+          QStringList{"Hann", "Triangle", "Tukey", "Gaussian"},
+          {},
+          "Hann",
+          "Grain window",
+          Id<Process::Port>(49),
+          this)}
+
+    , direction{new Process::Enum(
+          QStringList{"Forward", "Reverse", "Alternate"},
+          {},
+          "Forward",
+          "Direction",
+          Id<Process::Port>(50),
+          this)}
+
+    , key_map{
+          new Process::LineEdit("", "Key map", Id<Process::Port>(51), this)}
+
     , outlet{Process::make_audio_outlet(Id<Process::Port>(100), this)}
+    , buses{
+          Process::make_audio_outlet(Id<Process::Port>(101), this),
+          Process::make_audio_outlet(Id<Process::Port>(102), this),
+          Process::make_audio_outlet(Id<Process::Port>(103), this)}
 {
   outlet->setPropagate(true);
+  for (std::size_t i = 0; i < buses.size(); i++)
+    buses[i]->setName(tr("Bus %1").arg(i + 2));
   metadata().setInstanceName(*this);
   init();
-  //loadFile("/home/jcelerier/Documents/ossia/score/packages/dirt-samples/ade/006_glass.wav");
-  loadFile(
-      "/home/jcelerier/Documents/ossia/score/packages/dirt-samples/bass3/"
-      "83253__zgump__bass-0209.wav");
 }
 
 Model::~Model() { }
@@ -143,6 +378,14 @@ void Model::init()
   m_inlets.push_back(inlet.get());
   for_each_control([this](auto& ctl) { m_inlets.push_back(ctl.get()); });
   m_outlets.push_back(outlet.get());
+  for (auto& bus : buses)
+    m_outlets.push_back(bus.get());
+
+  connect(
+      storage.get(),
+      &Process::ControlInlet::valueChanged,
+      this,
+      &Model::startCompression);
 }
 
 void Model::setFileForced(const QString& file)
@@ -158,27 +401,433 @@ QString Model::prettyName() const noexcept
 
 void Model::loadFile(const QString& file)
 {
-  if (m_file)
-    m_file->on_mediaChanged.disconnect<&Model::fileChanged>(*this);
+  if (file.isEmpty())
+    return;
 
   auto& ctx = score::IDocument::documentContext(*this);
   auto r = std::make_shared<Media::AudioFile>();
   auto abspath = score::locateFilePath(file, ctx);
   r->load(file, file, Media::DecodingMethod::Libav);
-  m_file = r;
+  setFile(std::move(r));
+}
+
+void Model::releaseFile()
+{
+  if (!m_file)
+    return;
+
+  m_file->on_mediaChanged.disconnect<&Model::fileChanged>(*this);
+  m_file->on_mediaChanged.disconnect<&Model::reloadSound>(*this);
+  m_file->on_finishedDecoding.disconnect<&Model::startAnalysis>(*this);
+  m_file->on_finishedDecoding.disconnect<&Model::startCompression>(*this);
+  m_file.reset();
+  m_storeOnly = false;
+}
+
+void Model::setFile(std::shared_ptr<Media::AudioFile> file)
+{
+  if (!file || file == m_file)
+    return;
+
+  releaseFile();
+  m_kit.reset();
+  m_kitFile.clear();
+  m_file = std::move(file);
 
   m_file->on_mediaChanged.connect<&Model::fileChanged>(*this);
+  m_file->on_mediaChanged.connect<&Model::reloadSound>(*this);
+
+  fileChanged();
+  reloadSound();
+  startAnalysis();
+  startCompression();
+}
+
+void Model::setKit(std::shared_ptr<const kit> bundle, const QString& path)
+{
+  if (!bundle || bundle == m_kit)
+    return;
+
+  releaseFile();
+  m_kit = std::move(bundle);
+  m_kitFile = path;
+
+  fileChanged();
+  reloadSound();
+  startAnalysis();
+  startCompression();
+}
+
+void Model::clearSource()
+{
+  if (!m_file && !m_kit)
+    return;
+
+  releaseFile();
+  m_kit.reset();
+  m_kitFile.clear();
 
   fileChanged();
+  reloadSound();
+  startAnalysis();
+  startCompression();
+}
+
+bool Model::loadKit(const QString& path)
+{
+  auto bundle = read_kit(path.toStdString(), false);
+  if (!bundle)
+  {
+    qWarning() << "Samplette: could not load kit" << path;
+    return false;
+  }
+  setKit(std::move(bundle), path);
+  return true;
+}
+
+bool Model::saveKit(const QString& path)
+{
+  if (!m_sound && !m_store)
+    return false;
+
+  kit bundle;
+  for_each_control(
+      [&](auto& ctl) {
+        bundle.controls.emplace_back(ctl->name().toStdString(), ctl->value());
+      });
+  if (m_file)
+    bundle.sample_name = m_file->fileName().toStdString();
+  else if (m_kit)
+    bundle.sample_name = m_kit->sample_name;
+  bundle.sound = m_sound;
+  bundle.sample_rate = m_soundRate;
+  bundle.store = m_store;
+  return write_kit(path.toStdString(), bundle);
 }
 
+// The sound is played as it gets decoded, like the Sound process does
+void Model::reloadSound()
+{
+  m_sound.reset();
+  m_soundRate = 0;
+  if (m_kit)
+  {
+    m_sound = m_kit->sound;
+    m_soundRate = m_kit->sample_rate;
+  }
+  else if (m_file)
+  {
+    auto reader
+        = m_file->unsafe_handle()
+              .target<std::shared_ptr<Media::AudioFile::LibavReader>>();
+    if (reader && *reader)
+    {
+      if (!m_storeOnly)
+        m_sound = (*reader)->handle;
+      m_soundRate = (*reader)->decoder.fileSampleRate;
+    }
+  }
+  soundChanged();
+}
+
+// Once the compressed copy of an audio file is ready, the file plays from
+// it alone like kits do: the executor gets no float data to keep alive.
+void Model::dropFloats()
+{
+  if (!m_file || !m_store)
+    return;
+  m_storeOnly = true;
+  if (m_sound)
+  {
+    m_sound.reset();
+    soundChanged();
+  }
+}
+
+std::string Model::soundPath() const
+{
+  if (m_kit)
+    return m_kitFile.toStdString();
+  if (m_file)
+    return m_file->absoluteFileName().toStdString();
+  return {};
+}
+
+void Model::startAnalysis()
+{
+  const auto path = soundPath();
+  if (auto cached = path.empty() ? nullptr : cached_analysis(path))
+  {
+    m_analysis = std::move(cached);
+    analysisChanged();
+    return;
+  }
+
+  if (m_analysis)
+  {
+    m_analysis.reset();
+    analysisChanged();
+  }
+
+  if (m_file && !m_file->finishedDecoding())
+  {
+    m_file->on_finishedDecoding.connect<&Model::startAnalysis>(*this);
+    return;
+  }
+  if (m_file)
+    m_file->on_finishedDecoding.disconnect<&Model::startAnalysis>(*this);
+
+  // Sources playing from their store alone are analyzed from it
+  std::shared_ptr<const sample_store> store;
+  if (!m_sound)
+    store = m_kit ? m_kit->store : m_storeOnly ? m_store : nullptr;
+  if (!m_sound && !store)
+    return;
+
+  // The analysis goes through the whole file: do it in the background and
+  // come back to the main thread once done.
+  QThreadPool::globalInstance()->start(
+      [self = QPointer<Model>{this},
+       handle = m_sound,
+       store = std::move(store),
+       path]
+      {
+        std::shared_ptr<const sample_analysis> res;
+        if (handle)
+        {
+          std::vector<const float*> channels;
+          for (auto& chan : handle->data)
+            channels.push_back(chan.data());
+          const int64_t frames
+              = handle->data.empty() ? 0 : handle->data[0].size();
+          res = analyze_sample(channels, frames);
+        }
+        else
+        {
+          res = analyze_sample(*store);
+        }
+        cache_analysis(path, res);
+
+        ossia::qt::run_async(
+            qApp,
+            [self, res = std::move(res), path]() mutable
+            {
+              if (!self || self->soundPath() != path)
+                return;
+
+              self->m_analysis = std::move(res);
+              self->analysisChanged();
+            });
+      });
+}
+
+sample_format Model::storageFormat() const noexcept
+{
+  return sample_format_from_string(
+      ossia::convert<std::string>(storage->value()));
+}
+
+double Model::latency() const noexcept
+{
+  if (!ossia::convert<bool>(limiter->value()))
+    return 0.;
+  return std::clamp(
+      ossia::convert<float>(lookahead->value()) / 1000.,
+      0.,
+      max_lookahead_seconds);
+}
+
+void Model::startCompression()
+{
+  const auto format = storageFormat();
+
+  if (m_store)
+  {
+    m_store.reset();
+    // An audio file which dropped its float handle gets it back from the
+    // decoder, to play from or to compress again
+    if (m_storeOnly)
+    {
+      m_storeOnly = false;
+      reloadSound();
+    }
+    storeChanged();
+  }
+  // Kits saved with this storage already contain the compressed copy
+  if (format != sample_format::Float32 && m_kit && m_kit->store
+      && m_kit->store->format == format)
+  {
+    m_store = m_kit->store;
+    storeChanged();
+    return;
+  }
+
+  // Kits loaded with their compressed copy alone need their float data for
+  // any other storage. If the file is gone, the copy keeps playing.
+  if (m_kit && !m_kit->sound)
+  {
+    if (auto full = read_kit(m_kitFile.toStdString()))
+    {
+      setKit(std::move(full), m_kitFile);
+      return;
+    }
+    qWarning() << "Samplette: could not load kit" << m_kitFile;
+    m_store = m_kit->store;
+    storeChanged();
+    return;
+  }
+
+  if (format == sample_format::Float32)
+    return;
+
+  const auto path = soundPath();
+  if (auto cached = path.empty() ? nullptr : cached_store(path, format))
+  {
+    m_store = std::move(cached);
+    storeChanged();
+    dropFloats();
+    return;
+  }
+
+  if (m_file && !m_file->finishedDecoding())
+  {
+    m_file->on_finishedDecoding.connect<&Model::startCompression>(*this);
+    return;
+  }
+  if (m_file)
+    m_file->on_finishedDecoding.disconnect<&Model::startCompression>(*this);
+
+  if (!m_sound)
+    return;
+
+  QThreadPool::globalInstance()->start(
+      [self = QPointer<Model>{this}, handle = m_sound, format, path]
+      {
+        std::vector<const float*> channels;
+        for (auto& chan : handle->data)
+          channels.push_back(chan.data());
+        const int64_t frames
+            = handle->data.empty() ? 0 : handle->data[0].size();
+
+        auto res = make_sample_store(channels, frames, format);
+        if (!path.empty())
+          cache_store(path, res);
+
+        ossia::qt::run_async(
+            qApp,
+            [self, res = std::move(res), handle, format]() mutable
+            {
+              if (!self || !res)
+                return;
+
+              // The sound or the storage may have changed in the meantime
+              if (self->m_sound != handle || self->storageFormat() != format)
+                return;
+
+              self->m_store = std::move(res);
+              self->storeChanged();
+              self->dropFloats();
+            });
+      });
+}
+
+void Model::setFrozenFile(const QString& file)
+{
+  m_frozen.reset();
+  m_frozenRate = 0;
+  m_frozenFile.clear();
+  if (!file.isEmpty())
+  {
+    int rate{};
+    if (auto res = read_wav(file.toStdString(), rate))
+    {
+      m_frozen = std::move(res);
+      m_frozenRate = rate;
+      m_frozenFile = file;
+    }
+    else
+    {
+      qWarning() << "Samplette: could not load frozen render" << file;
+    }
+  }
+  frozenChanged();
+}
+
+void Model::setCapturedMidi(midi_capture capture)
+{
+  m_capture = std::move(capture);
+  capturedMidiChanged();
+}
+
+void Model::freeze()
+{
+  if (m_freezing || m_capture.events.empty())
+    return;
+
+  if (!m_sound && !m_store)
+    return;
+
+  render_job job;
+  job.sound = m_sound;
+  job.channels = m_sound ? m_sound->data.size() : m_store->size();
+  job.sound_rate = m_soundRate;
+  job.analysis = m_analysis;
+  job.store = m_store;
+  for_each_control([&](auto& ctl) { job.controls.push_back(ctl->value()); });
+  job.midi = m_capture;
+
+  const auto dir = QStandardPaths::writableLocation(
+                       QStandardPaths::CacheLocation)
+                   + "/samplette";
+  QDir{}.mkpath(dir);
+  const auto path = dir + "/"
+                    + QUuid::createUuid().toString(QUuid::WithoutBraces)
+                    + ".wav";
+
+  m_freezing = true;
+  freezingChanged();
+
+  // Rendering is done faster than real-time, but still takes a while for
+  // long parts: do it in the background and come back to the main thread
+  // to record the change in the command stack.
+  QThreadPool::globalInstance()->start(
+      [self = QPointer<Model>{this}, job = std::move(job), path]
+      {
+        const auto res = render_offline(job);
+        const bool ok = !res->data.empty()
+                        && write_wav(
+                            path.toStdString(), *res, job.midi.sample_rate);
+
+        ossia::qt::run_async(
+            qApp,
+            [self, path, ok]
+            {
+              if (!self)
+                return;
+
+              self->m_freezing = false;
+              self->freezingChanged();
+              if (!ok)
+              {
+                qWarning() << "Samplette: could not render" << path;
+                return;
+              }
+
+              auto& ctx = score::IDocument::documentContext(*self);
+              CommandDispatcher<>{ctx.commandStack}.submit<SetFrozen>(
+                  *self, path);
+            });
+      });
+}
 }
 
 template <>
 void DataStreamReader::read(const Samplette::Model& proc)
 {
   readPorts(*this, proc.m_inlets, proc.m_outlets);
-  m_stream << proc.m_file->originalFile();
+  m_stream << (proc.m_file ? proc.m_file->originalFile() : QString{});
+  m_stream << proc.m_frozenFile;
+  m_stream << proc.m_kitFile;
 
   insertDelimiter();
 }
@@ -195,7 +844,15 @@ void DataStreamWriter::write(Samplette::Model& proc)
 
   QString s;
   m_stream >> s;
-  proc.loadFile(s);
+
+  QString frozen;
+  m_stream >> frozen;
+  proc.setFrozenFile(frozen);
+
+  QString kit;
+  m_stream >> kit;
+  if (kit.isEmpty() || !proc.loadKit(kit))
+    proc.loadFile(s);
 
   checkDelimiter();
 }
@@ -204,7 +861,11 @@ template <>
 void JSONReader::read(const Samplette::Model& proc)
 {
   readPorts(*this, proc.m_inlets, proc.m_outlets);
-  obj["File"] = proc.m_file->originalFile();
+  obj["File"] = proc.m_file ? proc.m_file->originalFile() : QString{};
+  if (!proc.m_kitFile.isEmpty())
+    obj["Kit"] = proc.m_kitFile;
+  if (!proc.m_frozenFile.isEmpty())
+    obj["Frozen"] = proc.m_frozenFile;
 }
 
 template <>
@@ -217,5 +878,9 @@ void JSONWriter::write(Samplette::Model& proc)
       proc.m_outlets,
       &proc);
 
-  proc.loadFile(obj["File"].toString());
+  auto kit = obj.tryGet("Kit");
+  if (!kit || !proc.loadKit(kit->toString()))
+    proc.loadFile(obj["File"].toString());
+  if (auto frozen = obj.tryGet("Frozen"))
+    proc.setFrozenFile(frozen->toString());
 }
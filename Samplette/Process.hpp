@@ -4,7 +4,12 @@
 #include <Process/Dataflow/Port.hpp>
 #include <Media/MediaFileHandle.hpp>
 
+#include <Samplette/Analysis.hpp>
+#include <Samplette/Freeze.hpp>
+#include <Samplette/Kit.hpp>
 #include <Samplette/Metadata.hpp>
+#include <Samplette/SampleStore.hpp>
+#include <Samplette/Zones.hpp>
 
 namespace Samplette
 {
@@ -31,9 +36,67 @@ public:
   ~Model() override;
 
   void setFileForced(const QString& file);
+  // Reuses an already loaded file, e.g. when undoing a file change
+  void setFile(std::shared_ptr<Media::AudioFile> file);
   const std::shared_ptr<Media::AudioFile>& file() const noexcept { return m_file; }
 
+  // The decoded sample played by the process: from the audio file, or from
+  // the kit bundle the process was loaded from. Null for kits loaded with
+  // their compressed copy alone, which is then the store.
+  const ossia::audio_handle& sound() const noexcept { return m_sound; }
+  int soundSampleRate() const noexcept { return m_soundRate; }
+
+  // Kit bundles: the kit replaces the audio file, and the controls are
+  // set separately, e.g. by the LoadKit command.
+  const QString& kitFile() const noexcept { return m_kitFile; }
+  const std::shared_ptr<const kit>& loadedKit() const noexcept
+  {
+    return m_kit;
+  }
+  void setKit(std::shared_ptr<const kit> bundle, const QString& path);
+  bool loadKit(const QString& path);
+  bool saveKit(const QString& path);
+
+  // Back to no sample at all, e.g. when undoing the first load
+  void clearSource();
+
+  const std::shared_ptr<const sample_analysis>& analysis() const noexcept
+  {
+    return m_analysis;
+  }
+
+  // Freeze: the output of the process is rendered offline from the MIDI
+  // received during the last playback and played back from a file.
+  const QString& frozenFile() const noexcept { return m_frozenFile; }
+  const ossia::audio_handle& frozen() const noexcept { return m_frozen; }
+  int frozenSampleRate() const noexcept { return m_frozenRate; }
+  void setFrozenFile(const QString& file);
+
+  const midi_capture& capturedMidi() const noexcept { return m_capture; }
+  void setCapturedMidi(midi_capture capture);
+
+  bool freezing() const noexcept { return m_freezing; }
+  void freeze();
+
+  // Compressed copy of the sample used for playback, or null when
+  // playing from the float data. Once it is ready, sound() is null for
+  // audio files as for kits: only the decoder keeps the float data, for
+  // the waveform.
+  const std::shared_ptr<const sample_store>& store() const noexcept
+  {
+    return m_store;
+  }
+
+  // Delay added by the limiter, in seconds
+  double latency() const noexcept;
+
   void fileChanged() W_SIGNAL(fileChanged)
+  void soundChanged() W_SIGNAL(soundChanged)
+  void storeChanged() W_SIGNAL(storeChanged)
+  void analysisChanged() W_SIGNAL(analysisChanged)
+  void frozenChanged() W_SIGNAL(frozenChanged)
+  void capturedMidiChanged() W_SIGNAL(capturedMidiChanged)
+  void freezingChanged() W_SIGNAL(freezingChanged)
 
   std::unique_ptr<Process::MidiInlet> inlet;
 
@@ -59,7 +122,60 @@ public:
   std::unique_ptr<Process::ControlInlet> velocity;
   std::unique_ptr<Process::ControlInlet> fade;
 
+  std::unique_ptr<Process::ControlInlet> snap;
+  std::unique_ptr<Process::ControlInlet> gate_ramp;
+  std::unique_ptr<Process::ControlInlet> bend_range;
+  std::unique_ptr<Process::ControlInlet> mpe;
+  std::unique_ptr<Process::ControlInlet> engine;
+
+  std::unique_ptr<Process::ControlInlet> filter;
+  std::unique_ptr<Process::ControlInlet> cutoff;
+  std::unique_ptr<Process::ControlInlet> resonance;
+  std::unique_ptr<Process::ControlInlet> filter_env;
+  std::unique_ptr<Process::ControlInlet> filter_attack;
+  std::unique_ptr<Process::ControlInlet> filter_decay;
+  std::unique_ptr<Process::ControlInlet> key_track;
+  std::unique_ptr<Process::ControlInlet> filter_velocity;
+
+  std::unique_ptr<Process::ControlInlet> choke_group;
+
+  std::unique_ptr<Process::ControlInlet> sync;
+  std::unique_ptr<Process::ControlInlet> bpm;
+  std::unique_ptr<Process::ControlInlet> beats;
+
+  std::unique_ptr<Process::ControlInlet> storage;
+
+  std::unique_ptr<Process::ControlInlet> outputs;
+  std::unique_ptr<Process::ControlInlet> pan;
+  std::unique_ptr<Process::ControlInlet> spread;
+  std::unique_ptr<Process::ControlInlet> pan_key_track;
+  std::unique_ptr<Process::ControlInlet> pan_velocity;
+  std::unique_ptr<Process::ControlInlet> pan_random;
+
+  std::unique_ptr<Process::ControlInlet> zones;
+
+  // Ceiling in dB, lookahead in milliseconds
+  std::unique_ptr<Process::ControlInlet> limiter;
+  std::unique_ptr<Process::ControlInlet> ceiling;
+  std::unique_ptr<Process::ControlInlet> lookahead;
+  std::unique_ptr<Process::ControlInlet> auto_gain;
+
+  // Granular engine: size in milliseconds, density in grains per second,
+  // position and jitter in percents of the region
+  std::unique_ptr<Process::ControlInlet> grain_size;
+  std::unique_ptr<Process::ControlInlet> grain_density;
+  std::unique_ptr<Process::ControlInlet> grain_position;
+  std::unique_ptr<Process::ControlInlet> grain_jitter;
+  std::unique_ptr<Process::ControlInlet> grain_shape;
+
+  std::unique_ptr<Process::ControlInlet> direction;
+
+  // Key samples of a multisample, see parse_multisample
+  std::unique_ptr<Process::ControlInlet> key_map;
+
   std::unique_ptr<Process::AudioOutlet> outlet;
+  // Buses 2 and up, which the zones can route notes to
+  std::array<std::unique_ptr<Process::AudioOutlet>, max_buses - 1> buses;
 
   void for_each_control(auto&& f)
   {
@@ -84,14 +200,82 @@ public:
 
     f(this->velocity);
     f(this->fade);
+
+    f(this->snap);
+    f(this->gate_ramp);
+    f(this->bend_range);
+    f(this->mpe);
+    f(this->engine);
+
+    f(this->filter);
+    f(this->cutoff);
+    f(this->resonance);
+    f(this->filter_env);
+    f(this->filter_attack);
+    f(this->filter_decay);
+    f(this->key_track);
+    f(this->filter_velocity);
+
+    f(this->choke_group);
+
+    f(this->sync);
+    f(this->bpm);
+    f(this->beats);
+
+    f(this->storage);
+
+    f(this->outputs);
+    f(this->pan);
+    f(this->spread);
+    f(this->pan_key_track);
+    f(this->pan_velocity);
+    f(this->pan_random);
+
+    f(this->zones);
+
+    f(this->limiter);
+    f(this->ceiling);
+    f(this->lookahead);
+    f(this->auto_gain);
+
+    f(this->grain_size);
+    f(this->grain_density);
+    f(this->grain_position);
+    f(this->grain_jitter);
+    f(this->grain_shape);
+
+    f(this->direction);
+
+    f(this->key_map);
   }
 
 private:
   void init();
   void loadFile(const QString& str);
+  void releaseFile();
+  void reloadSound();
+  void dropFloats();
+  std::string soundPath() const;
+  void startAnalysis();
+  void startCompression();
+  sample_format storageFormat() const noexcept;
   QString prettyName() const noexcept override;
 
   std::shared_ptr<Media::AudioFile> m_file;
+  std::shared_ptr<const kit> m_kit;
+  QString m_kitFile;
+  ossia::audio_handle m_sound;
+  int m_soundRate{};
+  std::shared_ptr<const sample_analysis> m_analysis;
+  std::shared_ptr<const sample_store> m_store;
+  // The audio file plays from m_store alone, see dropFloats
+  bool m_storeOnly{};
+
+  QString m_frozenFile;
+  ossia::audio_handle m_frozen;
+  int m_frozenRate{};
+  midi_capture m_capture;
+  bool m_freezing{};
 };
 
 using ProcessFactory = Process::ProcessFactory_T<Samplette::Model>;
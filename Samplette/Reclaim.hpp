@@ -0,0 +1,49 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace Samplette
+{
+// Objects the audio thread lets go of, e.g. the previous sound, are not
+// destroyed there: they are pushed in this queue and destroyed when a
+// non-real-time thread drains it.
+// Single producer, single consumer, with a fixed capacity.
+template <std::size_t N>
+class reclaim_queue
+{
+public:
+  using item = std::shared_ptr<const void>;
+
+  // Audio thread. Takes the object out of `value` on success; when the
+  // queue is full it is left there and the caller decides what to do.
+  bool push(item& value) noexcept
+  {
+    const auto head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == N)
+      return false;
+
+    m_items[head % N] = std::move(value);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Any other thread: destroys what was pushed so far
+  void drain() noexcept
+  {
+    auto tail = m_tail.load(std::memory_order_relaxed);
+    const auto head = m_head.load(std::memory_order_acquire);
+    for (; tail != head; tail++)
+    {
+      m_items[tail % N].reset();
+      m_tail.store(tail + 1, std::memory_order_release);
+    }
+  }
+
+private:
+  std::array<item, N> m_items{};
+  std::atomic<std::size_t> m_head{};
+  std::atomic<std::size_t> m_tail{};
+};
+}
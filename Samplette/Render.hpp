@@ -0,0 +1,235 @@
+#pragma once
+#include <Samplette/Analysis.hpp>
+#include <Samplette/Kernels.hpp>
+#include <Samplette/SampleStore.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+namespace Samplette
+{
+// Direction of the voices. With Alternate, each note plays the other way
+// from the previous one.
+enum class play_direction : uint8_t
+{
+  Forward,
+  Reverse,
+  Alternate
+};
+
+[[nodiscard]] inline play_direction
+play_direction_from_string(const std::string& str) noexcept
+{
+  if (str == "Reverse")
+    return play_direction::Reverse;
+  else if (str == "Alternate")
+    return play_direction::Alternate;
+  return play_direction::Forward;
+}
+
+// Copies frames [start; start + n) of a channel
+template <typename Data>
+void read_frames(
+    const Data& data,
+    std::size_t channel,
+    int64_t start,
+    int64_t n,
+    float* out) noexcept
+{
+  std::copy_n(data[channel].data() + start, n, out);
+}
+
+inline void read_frames(
+    const sample_store& data,
+    std::size_t channel,
+    int64_t start,
+    int64_t n,
+    float* out) noexcept
+{
+  data.decode(channel, start, n, out);
+}
+
+// Copies frames [start; start + n) of a channel, last one first
+template <typename Data>
+void read_frames_reversed(
+    const Data& data,
+    std::size_t channel,
+    int64_t start,
+    int64_t n,
+    float* out) noexcept
+{
+  read_frames(data, channel, start, n, out);
+  std::reverse(out, out + n);
+}
+
+// The frames a voice plays in its direction. A looping region loops over
+// the same frames both ways: in reverse, it plays from its end down to
+// the loop start, then again from its end.
+[[nodiscard]] inline sample_region
+directed_region(sample_region region, bool loops, bool reverse) noexcept
+{
+  if (reverse && loops && region.loop_start < region.length)
+  {
+    region.start += region.loop_start;
+    region.length -= region.loop_start;
+    region.loop_start = 0;
+  }
+  return region;
+}
+
+// Reads from the playback region: pos is relative to the region start,
+// and wraps to the loop start once past the region end when looping.
+// In reverse, positions are counted from the region end instead and the
+// region is read through directed_region.
+template <typename Data>
+void read_region(
+    const Data& data,
+    const sample_region& playback,
+    bool loops,
+    int64_t pos,
+    int64_t frames,
+    float* const* audio_array,
+    bool reverse = false) noexcept
+{
+  const auto region = directed_region(playback, loops, reverse);
+  const std::size_t channels = data.size();
+  const int64_t loop_length = region.length - region.loop_start;
+  int64_t written = 0;
+  while (written < frames)
+  {
+    int64_t p = pos + written;
+    if (p >= region.length)
+    {
+      if (!loops || loop_length <= 0)
+        break;
+      p = region.loop_start + (p - region.length) % loop_length;
+    }
+
+    const int64_t n = std::min(frames - written, region.length - p);
+    for (std::size_t c = 0; c < channels; c++)
+    {
+      if (reverse)
+        read_frames_reversed(
+            data,
+            c,
+            region.start + region.length - p - n,
+            n,
+            audio_array[c] + written);
+      else
+        read_frames(data, c, region.start + p, n, audio_array[c] + written);
+    }
+    written += n;
+  }
+
+  for (std::size_t c = 0; c < channels; c++)
+  {
+    std::fill_n(audio_array[c] + written, frames - written, 0.f);
+  }
+}
+
+// Reads the region with linear interpolation, starting at `position`
+// (in frames from the region start, or from its end in reverse) and
+// advancing by `ratio` per frame.
+// The output is rendered by segments which do not cross the region end,
+// with the kernel chosen once for the block, so that the inner loop has
+// no branch. Returns the new position.
+template <typename Data>
+double read_region_linear(
+    const Data& data,
+    const sample_region& playback,
+    bool loops,
+    double position,
+    double ratio,
+    double* const* out,
+    int64_t frames,
+    bool reverse = false) noexcept
+{
+  const auto region = directed_region(playback, loops, reverse);
+  const std::size_t channels = data.size();
+  // Frame k of the playback is at in[k * dir]
+  const int64_t first = reverse ? region.start + region.length - 1
+                                : region.start;
+  const int64_t dir = reverse ? -1 : 1;
+  const int64_t loop_length = region.length - region.loop_start;
+  const auto kernel = select_interpolate<Data>(channels, reverse, ratio);
+  int64_t k = 0;
+  while (k < frames)
+  {
+    if (position >= region.length)
+    {
+      if (!loops || loop_length <= 0)
+        break;
+      position = region.loop_start
+                 + std::fmod(position - region.length, double(loop_length));
+    }
+
+    // How many frames can be read before needing a sample past the end
+    const double room = (region.length - 1 - position) / ratio;
+    const int64_t segment
+        = std::min<int64_t>(frames - k, room > 0. ? std::ceil(room) : 0);
+
+    if (segment > 0)
+    {
+      kernel(data, channels, first, position, ratio, out, k, segment);
+      position += segment * ratio;
+      k += segment;
+    }
+    else
+    {
+      // Last frame of the region: interpolate towards the loop start
+      const int64_t idx = position;
+      const int64_t next = loops ? region.loop_start : idx;
+      const double frac = position - idx;
+      for (std::size_t c = 0; c < channels; c++)
+      {
+        const float* in = data[c].data() + first;
+        out[c][k] = in[idx * dir] + frac * (in[next * dir] - in[idx * dir]);
+      }
+      position += ratio;
+      k++;
+    }
+  }
+
+  for (std::size_t c = 0; c < channels; c++)
+  {
+    std::fill_n(out[c] + k, frames - k, 0.);
+  }
+  return position;
+}
+
+// Linear interpolation for data which cannot be addressed directly: the
+// frames needed by the block are first read in playback order, loops
+// unrolled, to `cache`, which must hold frames * ratio + 2 frames per
+// channel.
+template <typename Data>
+double read_region_linear_cached(
+    const Data& data,
+    const sample_region& region,
+    bool loops,
+    double position,
+    double ratio,
+    double* const* out,
+    int64_t frames,
+    float* const* cache,
+    bool reverse = false) noexcept
+{
+  const std::size_t channels = data.size();
+  const int64_t base = position;
+  const int64_t count = int64_t(position + (frames - 1) * ratio) - base + 2;
+  read_region(data, region, loops, base, count, cache, reverse);
+
+  // The cache is in playback order
+  select_interpolate<float* const*>(channels, false, ratio)(
+      cache, channels, 0, position - base, ratio, out, 0, frames);
+
+  position += frames * ratio;
+  const auto played = directed_region(region, loops, reverse);
+  const int64_t loop_length = played.length - played.loop_start;
+  if (loops && loop_length > 0 && position >= played.length)
+    position = played.loop_start
+               + std::fmod(position - played.length, double(loop_length));
+  return position;
+}
+}
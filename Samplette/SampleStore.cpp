@@ -0,0 +1,191 @@
+#include "SampleStore.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+namespace Samplette
+{
+namespace
+{
+struct store_cache
+{
+  std::mutex mutex;
+  std::map<
+      std::pair<std::string, sample_format>,
+      std::weak_ptr<const sample_store>>
+      entries;
+
+  static store_cache& instance()
+  {
+    static store_cache cache;
+    return cache;
+  }
+};
+
+// The block offsets are 32-bit, and a block takes at most 2 bytes per
+// frame plus its header
+constexpr int64_t max_packed_frames{int64_t(1) << 30};
+
+void pack_channel(const int16_t* in, int64_t frames, std::vector<uint8_t>& out)
+{
+  const int64_t blocks = (frames + packed_block - 1) / packed_block;
+  out.assign(4 * (blocks + 1), 0);
+
+  uint16_t diffs[packed_block];
+  for (int64_t b = 0; b < blocks; b++)
+  {
+    const uint32_t offset = out.size();
+    std::memcpy(out.data() + 4 * b, &offset, sizeof(offset));
+
+    const int16_t* block = in + b * packed_block;
+    const int64_t n = std::min(packed_block, frames - b * packed_block);
+    uint16_t largest = 0;
+    for (int64_t i = 1; i < n; i++)
+    {
+      // Differences wrap around like the sums which decode them
+      const int16_t d = int16_t(uint16_t(block[i]) - uint16_t(block[i - 1]));
+      diffs[i] = uint16_t(d * 2) ^ uint16_t(d >> 15);
+      largest = std::max(largest, diffs[i]);
+    }
+    const int width = std::bit_width(largest);
+
+    out.push_back(uint16_t(block[0]) & 0xFF);
+    out.push_back(uint16_t(block[0]) >> 8);
+    out.push_back(width);
+    uint64_t acc = 0;
+    int bits = 0;
+    for (int64_t i = 1; i < n; i++)
+    {
+      acc |= uint64_t(diffs[i]) << bits;
+      bits += width;
+      for (; bits >= 8; bits -= 8, acc >>= 8)
+        out.push_back(acc & 0xFF);
+    }
+    if (bits > 0)
+      out.push_back(acc & 0xFF);
+  }
+
+  const uint32_t end = out.size();
+  std::memcpy(out.data() + 4 * blocks, &end, sizeof(end));
+  out.resize(out.size() + packed_padding);
+}
+}
+
+std::size_t
+packed_channel_bytes(const uint8_t* data, std::size_t size, int64_t frames)
+{
+  if (frames <= 0 || frames > max_packed_frames)
+    return 0;
+  const int64_t blocks = (frames + packed_block - 1) / packed_block;
+  const std::size_t table = 4 * (blocks + 1);
+  if (size < table + packed_padding || packed_offset(data, 0) != table)
+    return 0;
+
+  for (int64_t b = 0; b < blocks; b++)
+  {
+    const std::size_t begin = packed_offset(data, b);
+    const std::size_t end = packed_offset(data, b + 1);
+    if (end < begin + 3 || end > size - packed_padding)
+      return 0;
+
+    const int width = data[begin + 2];
+    const int64_t n = std::min(packed_block, frames - b * packed_block);
+    const std::size_t bits = (n - 1) * width;
+    if (width > 16 || end - begin < 3 + (bits + 7) / 8)
+      return 0;
+  }
+  return packed_offset(data, blocks) + packed_padding;
+}
+
+std::shared_ptr<const sample_store> make_sample_store(
+    std::span<const float* const> channels,
+    int64_t frames,
+    sample_format format)
+{
+  if (format == sample_format::Float32
+      || (format == sample_format::Packed16 && frames > max_packed_frames))
+    return {};
+
+  auto res = std::make_shared<sample_store>();
+  res->format = format;
+  res->frames = frames;
+  res->data.resize(channels.size());
+
+  // Samples which come from 16 or 24-bit files are converted back exactly
+  const auto quantize = [](float x, double scale) {
+    const double v = std::nearbyint(double(x) * scale);
+    return int32_t(std::clamp(v, -scale, scale - 1.));
+  };
+
+  for (std::size_t c = 0; c < channels.size(); c++)
+  {
+    const float* in = channels[c];
+    auto& out = res->data[c];
+    switch (format)
+    {
+      case sample_format::Int16:
+      {
+        out.resize(frames * sizeof(int16_t));
+        for (int64_t i = 0; i < frames; i++)
+        {
+          const int16_t v = quantize(in[i], 32768.);
+          std::memcpy(out.data() + i * sizeof(int16_t), &v, sizeof(v));
+        }
+        break;
+      }
+      case sample_format::Int24:
+      {
+        out.resize(frames * 3);
+        for (int64_t i = 0; i < frames; i++)
+        {
+          const uint32_t v = quantize(in[i], 8388608.);
+          out[3 * i] = v & 0xFF;
+          out[3 * i + 1] = (v >> 8) & 0xFF;
+          out[3 * i + 2] = (v >> 16) & 0xFF;
+        }
+        break;
+      }
+      case sample_format::Packed16:
+      {
+        std::vector<int16_t> values(frames);
+        for (int64_t i = 0; i < frames; i++)
+          values[i] = quantize(in[i], 32768.);
+        pack_channel(values.data(), frames, out);
+        break;
+      }
+      case sample_format::Float32:
+        break;
+    }
+  }
+  return res;
+}
+
+std::shared_ptr<const sample_store>
+cached_store(const std::string& path, sample_format format)
+{
+  auto& cache = store_cache::instance();
+  std::lock_guard lock{cache.mutex};
+  if (auto it = cache.entries.find({path, format}); it != cache.entries.end())
+  {
+    if (auto ptr = it->second.lock())
+      return ptr;
+    cache.entries.erase(it);
+  }
+  return {};
+}
+
+void cache_store(
+    const std::string& path,
+    const std::shared_ptr<const sample_store>& store)
+{
+  if (!store)
+    return;
+  auto& cache = store_cache::instance();
+  std::lock_guard lock{cache.mutex};
+  cache.entries[{path, store->format}] = store;
+}
+}
@@ -0,0 +1,214 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Samplette
+{
+enum class sample_format : uint8_t
+{
+  Float32,
+  Int16,
+  Int24,
+  Packed16
+};
+
+// From the values of the "Storage" control
+[[nodiscard]] inline sample_format
+sample_format_from_string(const std::string& str) noexcept
+{
+  if (str == "16-bit")
+    return sample_format::Int16;
+  else if (str == "24-bit")
+    return sample_format::Int24;
+  else if (str == "Packed")
+    return sample_format::Packed16;
+  return sample_format::Float32;
+}
+
+// Integer to float conversion kernels
+inline void int16_to_float(const int16_t* in, float* out, int64_t n) noexcept
+{
+  constexpr float scale = 1.f / 32768.f;
+  int64_t i = 0;
+#if defined(__SSE2__)
+  const __m128 s = _mm_set1_ps(scale);
+  for (; i + 8 <= n; i += 8)
+  {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    // Sign-extend by putting the samples in the high halves
+    const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), s));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), s));
+  }
+#endif
+  for (; i < n; i++)
+    out[i] = in[i] * scale;
+}
+
+// 24-bit samples are packed little-endian in three bytes
+inline void int24_to_float(const uint8_t* in, float* out, int64_t n) noexcept
+{
+  constexpr float scale = 1.f / 2147483648.f;
+  for (int64_t i = 0; i < n; i++)
+  {
+    const uint8_t* p = in + 3 * i;
+    const int32_t v = int32_t(
+        uint32_t(p[0]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 24);
+    out[i] = v * scale;
+  }
+}
+
+// Packed 16-bit samples: each channel is cut in blocks of packed_block
+// frames, stored as their first value followed by the differences between
+// the next ones, zigzag-encoded on as many bits as the largest of them
+// needs. Smooth or quiet parts take a few bits per frame instead of 16,
+// and the 16-bit values come back exactly.
+//
+//   u32 offsets[blocks + 1]  from the channel start to each block, the
+//                            last one to the end of the blocks
+//   blocks                   i16 first value, u8 bit width, the packed
+//                            differences, least significant bit first
+//   packed_padding bytes     so that the bits are always read 64 at a time
+static constexpr const int64_t packed_block{256};
+static constexpr const std::size_t packed_padding{8};
+
+inline uint32_t packed_offset(const uint8_t* in, int64_t block) noexcept
+{
+  uint32_t res;
+  std::memcpy(&res, in + 4 * block, sizeof(res));
+  return res;
+}
+
+// Frames [0; n) of a block
+inline void unpack_block(const uint8_t* in, int64_t n, int16_t* out) noexcept
+{
+  uint16_t v;
+  std::memcpy(&v, in, sizeof(v));
+  const int width = in[2];
+  const uint8_t* bits = in + 3;
+  const uint64_t mask = (uint64_t(1) << width) - 1;
+
+  out[0] = v;
+  uint64_t pos = 0;
+  for (int64_t i = 1; i < n; i++, pos += width)
+  {
+    uint64_t word;
+    std::memcpy(&word, bits + (pos >> 3), sizeof(word));
+    const uint32_t z = (word >> (pos & 7)) & mask;
+    v += uint16_t((z >> 1) ^ -(z & 1));
+    out[i] = v;
+  }
+}
+
+// Decoding starts at the block which contains `start`
+inline void packed16_to_float(
+    const uint8_t* in,
+    int64_t start,
+    int64_t n,
+    float* out) noexcept
+{
+  int16_t block[packed_block];
+  while (n > 0)
+  {
+    const int64_t b = start / packed_block;
+    const int64_t first = start - b * packed_block;
+    const int64_t count = std::min(n, packed_block - first);
+    unpack_block(in + packed_offset(in, b), first + count, block);
+    int16_to_float(block + first, out, count);
+    start += count;
+    out += count;
+    n -= count;
+  }
+}
+
+// Keeps a sample as 16 or 24-bit integers, which takes a half or three
+// quarters of the memory of the float data, or as packed 16-bit blocks
+// which take less, and decodes it on demand.
+// Processes play from it alone: kits are loaded without their float data,
+// see read_kit, and audio files only keep theirs in the decoder.
+struct sample_store
+{
+  sample_format format{sample_format::Int16};
+  int64_t frames{};
+  std::vector<std::vector<uint8_t>> data;
+
+  std::size_t size() const noexcept { return data.size(); }
+
+  // Decodes frames [start; start + n) of a channel
+  void decode(std::size_t channel, int64_t start, int64_t n, float* out)
+      const noexcept
+  {
+    const uint8_t* in = data[channel].data();
+    switch (format)
+    {
+      case sample_format::Int16:
+        int16_to_float(
+            reinterpret_cast<const int16_t*>(in) + start, out, n);
+        break;
+      case sample_format::Int24:
+        int24_to_float(in + 3 * start, out, n);
+        break;
+      case sample_format::Packed16:
+        packed16_to_float(in, start, n, out);
+        break;
+      case sample_format::Float32:
+        break;
+    }
+  }
+
+  // The bytes decode reads for frames [start; start + n) of a channel
+  std::span<const uint8_t>
+  bytes(std::size_t channel, int64_t start, int64_t n) const noexcept
+  {
+    if (n <= 0)
+      return {};
+    const uint8_t* in = data[channel].data();
+    switch (format)
+    {
+      case sample_format::Int16:
+        return {in + 2 * start, std::size_t(2 * n)};
+      case sample_format::Int24:
+        return {in + 3 * start, std::size_t(3 * n)};
+      case sample_format::Packed16:
+      {
+        const uint32_t begin = packed_offset(in, start / packed_block);
+        const uint32_t end
+            = packed_offset(in, (start + n - 1) / packed_block + 1);
+        return {in + begin, end - begin};
+      }
+      case sample_format::Float32:
+        break;
+    }
+    return {};
+  }
+};
+
+// Size of a channel of packed samples of `frames` frames, or 0 if its
+// blocks do not fit in `size` bytes, e.g. for channels read from files.
+[[nodiscard]] std::size_t
+packed_channel_bytes(const uint8_t* data, std::size_t size, int64_t frames);
+
+[[nodiscard]] std::shared_ptr<const sample_store> make_sample_store(
+    std::span<const float* const> channels,
+    int64_t frames,
+    sample_format format);
+
+// Like the analyses, stores are shared across all the processes which use
+// the same file with the same format, and live as long as one of them
+// keeps them.
+[[nodiscard]] std::shared_ptr<const sample_store>
+cached_store(const std::string& path, sample_format format);
+void cache_store(
+    const std::string& path,
+    const std::shared_ptr<const sample_store>& store);
+}
@@ -55,8 +55,7 @@ void View::setData(const std::shared_ptr<Media::AudioFile>& data)
     m_data->on_finishedDecoding.disconnect<&View::recompute>(*this);
   }
 
-  SCORE_ASSERT(data);
-
+  // Kits have no audio file: there is no waveform to show
   m_data = data;
   if (m_data)
   {
@@ -64,6 +63,10 @@ void View::setData(const std::shared_ptr<Media::AudioFile>& data)
         *this);
     recompute();
   }
+  else
+  {
+    update();
+  }
 }
 
 void View::recompute() const
@@ -0,0 +1,282 @@
+#pragma once
+#include <Samplette/Analysis.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace Samplette
+{
+static constexpr const int max_voices{128};
+static constexpr const int max_filter_channels{8};
+
+// Adapted from http://www.martin-finke.de/blog/articles/audio-plugins-011-envelopes/
+enum envelope_stage : uint8_t
+{
+  Off,
+  Attack,
+  Decay,
+  Sustain,
+  Release
+};
+
+// Per-voice pedal state
+enum pedal_flags : uint8_t
+{
+  // The note off was received while a pedal held the voice
+  pedal_deferred = 1,
+  // The note was held when the sostenuto pedal went down
+  pedal_sostenuto = 2
+};
+
+// State of all the playing voices, stored as structure-of-arrays.
+// Active voices are packed in [0; count): a finished voice is replaced by
+// the last one, so that the block renderer only walks contiguous memory.
+// Heavier per-voice objects (stretchers, buffers) live elsewhere and are
+// reached through `slot`, which does not move.
+struct voice_bank
+{
+  static constexpr const double min_level{0.0001};
+
+  int count{};
+
+  // Identification
+  std::array<int16_t, max_voices> slot{};
+  std::array<int16_t, max_voices> key{};
+  std::array<int8_t, max_voices> channel{};
+  std::array<int8_t, max_voices> note{};
+  std::array<float, max_voices> velocity{};
+  std::array<uint64_t, max_voices> age{};
+  std::array<bool, max_voices> finished{};
+  std::array<uint8_t, max_voices> pedal{};
+
+  // Playback
+  std::array<double, max_voices> position{};
+  std::array<double, max_voices> note_ratio{};
+  std::array<double, max_voices> ratio{};
+  std::array<float, max_voices> gain{};
+  // Plays the region backwards, see read_region
+  std::array<bool, max_voices> reverse{};
+  // Part of the sound the voice plays, chosen at note on: its key sample
+  // for multisamples, else a length of 0 for the whole sound. The region
+  // is in frames of the sound and follows the region controls.
+  std::array<int64_t, max_voices> range_start{};
+  std::array<int64_t, max_voices> range_length{};
+  std::array<sample_region, max_voices> region{};
+
+  // Envelope
+  std::array<double, max_voices> env_level{};
+  std::array<double, max_voices> env_mult{};
+  std::array<int64_t, max_voices> env_remaining{};
+  std::array<envelope_stage, max_voices> env_stage{};
+
+  // Envelope settings, captured at note on. Durations are in samples.
+  std::array<int64_t, max_voices> env_attack{};
+  std::array<int64_t, max_voices> env_decay{};
+  std::array<float, max_voices> env_sustain{};
+  std::array<int64_t, max_voices> env_release{};
+
+  // Per-note expression
+  // In [-1; 1]
+  std::array<float, max_voices> bend{};
+  // Smoothed bend in cents
+  std::array<float, max_voices> bend_cents{};
+  // In [0; 1]
+  std::array<float, max_voices> pressure{};
+  std::array<float, max_voices> prev_pressure{};
+  // CC74, in [0; 1]
+  std::array<float, max_voices> timbre{};
+
+  // Filter: time since the note started in samples, for its envelope,
+  // and per-channel states. The coefficients are recomputed every block.
+  std::array<int64_t, max_voices> filter_time{};
+  std::array<std::array<float, max_voices>, max_filter_channels> svf_ic1{};
+  std::array<std::array<float, max_voices>, max_filter_channels> svf_ic2{};
+  std::array<float, max_voices> svf_k{};
+  std::array<float, max_voices> svf_a1{};
+  std::array<float, max_voices> svf_a2{};
+  std::array<float, max_voices> svf_a3{};
+
+  // Pan position chosen at note on, in [-1; 1]. The gains it gives for
+  // each output are in the voice's engine.
+  std::array<float, max_voices> pan{};
+  // Output bus, chosen at note on from the zones
+  std::array<int8_t, max_voices> bus{};
+  // Choke group of the note, from the key map or the zones; 0 for none
+  std::array<int8_t, max_voices> choke{};
+  // Sound the voice plays, among the ones the node keeps
+  std::array<int8_t, max_voices> sound{};
+
+  // Moves the last voice in place of voice i
+  void remove(int i) noexcept
+  {
+    const int last = --count;
+    if (i == last)
+      return;
+
+    slot[i] = slot[last];
+    key[i] = key[last];
+    channel[i] = channel[last];
+    note[i] = note[last];
+    velocity[i] = velocity[last];
+    age[i] = age[last];
+    finished[i] = finished[last];
+    pedal[i] = pedal[last];
+
+    position[i] = position[last];
+    note_ratio[i] = note_ratio[last];
+    ratio[i] = ratio[last];
+    gain[i] = gain[last];
+    reverse[i] = reverse[last];
+    range_start[i] = range_start[last];
+    range_length[i] = range_length[last];
+    region[i] = region[last];
+
+    env_level[i] = env_level[last];
+    env_mult[i] = env_mult[last];
+    env_remaining[i] = env_remaining[last];
+    env_stage[i] = env_stage[last];
+
+    env_attack[i] = env_attack[last];
+    env_decay[i] = env_decay[last];
+    env_sustain[i] = env_sustain[last];
+    env_release[i] = env_release[last];
+
+    bend[i] = bend[last];
+    bend_cents[i] = bend_cents[last];
+    pressure[i] = pressure[last];
+    prev_pressure[i] = prev_pressure[last];
+    timbre[i] = timbre[last];
+
+    filter_time[i] = filter_time[last];
+    for (int c = 0; c < max_filter_channels; c++)
+    {
+      svf_ic1[c][i] = svf_ic1[c][last];
+      svf_ic2[c][i] = svf_ic2[c][last];
+    }
+
+    pan[i] = pan[last];
+    bus[i] = bus[last];
+    choke[i] = choke[last];
+    sound[i] = sound[last];
+  }
+
+  [[nodiscard]] int oldest() const noexcept
+  {
+    return std::min_element(age.begin(), age.begin() + count) - age.begin();
+  }
+
+  static double
+  compute_multiplier(double start, double end, int64_t samples) noexcept
+  {
+    return std::exp((std::log(end) - std::log(start)) / samples);
+  }
+
+  void enter_stage(int i, envelope_stage stage) noexcept
+  {
+    env_stage[i] = stage;
+    switch (stage)
+    {
+      case Off:
+        env_remaining[i] = 0;
+        env_level[i] = 0.;
+        env_mult[i] = 1.;
+        finished[i] = true;
+        break;
+      case Attack:
+        env_remaining[i] = env_attack[i];
+        env_level[i] = min_level;
+        if (env_remaining[i] > 0)
+          env_mult[i]
+              = compute_multiplier(min_level, 1.0, env_remaining[i]);
+        break;
+      case Decay:
+        env_remaining[i] = env_decay[i];
+        env_level[i] = 1.0;
+        if (env_remaining[i] > 0)
+          env_mult[i] = compute_multiplier(
+              1.0,
+              std::max<double>(env_sustain[i], min_level),
+              env_remaining[i]);
+        break;
+      case Sustain:
+        env_remaining[i] = 0;
+        env_level[i] = env_sustain[i];
+        env_mult[i] = 1.;
+        break;
+      case Release:
+        // We could go from ATTACK/DECAY to RELEASE,
+        // so we're not changing the level here.
+        env_remaining[i] = env_release[i];
+        if (env_remaining[i] > 0)
+          env_mult[i] = compute_multiplier(
+              std::max(env_level[i], min_level),
+              min_level,
+              env_remaining[i]);
+        break;
+    }
+
+    // Zero-length stages are skipped
+    if (stage != Off && stage != Sustain && env_remaining[i] <= 0)
+      enter_stage(i, envelope_stage((stage + 1) % 5));
+  }
+
+  // Goes to the release stage with a custom duration, e.g. to stop a voice
+  // quickly without clicking. A release in progress is only ever shortened.
+  void fast_release(int i, int64_t samples) noexcept
+  {
+    if (env_stage[i] == Off)
+      return;
+    if (env_stage[i] == Release && env_remaining[i] <= samples)
+      return;
+
+    env_release[i] = samples;
+    enter_stage(i, Release);
+  }
+
+  // Writes the envelope of voice i for the next n samples.
+  // The stages are rendered by segments so that the inner loops do not
+  // branch; returns the number of samples before the voice finished.
+  int render_envelope(int i, float* out, int n) noexcept
+  {
+    int k = 0;
+    while (k < n)
+    {
+      switch (env_stage[i])
+      {
+        case Off:
+          std::fill_n(out + k, n - k, 0.f);
+          return k;
+
+        case Sustain:
+        {
+          const float level = env_level[i];
+          std::fill_n(out + k, n - k, level);
+          return n;
+        }
+
+        default:
+        {
+          const int segment = std::min<int64_t>(n - k, env_remaining[i]);
+          double level = env_level[i];
+          const double mult = env_mult[i];
+          for (int j = 0; j < segment; j++)
+          {
+            level *= mult;
+            out[k + j] = level;
+          }
+          env_level[i] = level;
+          env_remaining[i] -= segment;
+          k += segment;
+
+          if (env_remaining[i] == 0)
+            enter_stage(i, envelope_stage((env_stage[i] + 1) % 5));
+          break;
+        }
+      }
+    }
+    return n;
+  }
+};
+}
@@ -0,0 +1,185 @@
+#include "Zones.hpp"
+
+#include <Samplette/Choke.hpp>
+
+#include <charconv>
+#include <cstdio>
+
+namespace Samplette
+{
+namespace
+{
+template <typename T>
+bool parse_int(std::string_view str, T& res) noexcept
+{
+  if (!str.empty() && str.front() == '+')
+    str.remove_prefix(1);
+  const auto end = str.data() + str.size();
+  const auto [ptr, ec] = std::from_chars(str.data(), end, res);
+  return ec == std::errc{} && ptr == end;
+}
+
+// Parses "key" or "low-high". The dash of the range is searched after the
+// first character so that negative octaves such as "C-1" are not taken
+// for a range.
+bool parse_keys(std::string_view keys, int& low, int& high) noexcept
+{
+  auto dash = keys.find('-', 1);
+  while (dash != std::string_view::npos
+         && parse_note(keys.substr(0, dash)) < 0)
+    dash = keys.find('-', dash + 1);
+
+  low = parse_note(keys.substr(0, dash));
+  high = dash == std::string_view::npos ? low
+                                        : parse_note(keys.substr(dash + 1));
+  return low >= 0 && high >= low;
+}
+
+// Splits the choke group off the end of an entry: "x/group". Returns
+// false if the group is not valid; without a slash the group is 0.
+bool parse_choke(std::string_view& entry, int& group) noexcept
+{
+  group = 0;
+  const auto slash = entry.rfind('/');
+  if (slash == std::string_view::npos)
+    return true;
+  const auto str = entry.substr(slash + 1);
+  entry = entry.substr(0, slash);
+  return parse_int(str, group) && group >= 0 && group <= max_choke_groups;
+}
+
+// Calls f on each entry of a list separated by spaces, commas or semicolons
+template <typename F>
+void for_each_entry(std::string_view str, F&& f)
+{
+  constexpr std::string_view separators{" \t\n,;"};
+  while (!str.empty())
+  {
+    const auto start = str.find_first_not_of(separators);
+    if (start == std::string_view::npos)
+      break;
+    str.remove_prefix(start);
+    const auto entry = str.substr(0, str.find_first_of(separators));
+    str.remove_prefix(entry.size());
+    f(entry);
+  }
+}
+}
+
+int parse_note(std::string_view str) noexcept
+{
+  int note{};
+  if (parse_int(str, note))
+    return note >= 0 && note < 128 ? note : -1;
+
+  // Semitones of A to G from C
+  static constexpr int pitch_classes[7]{9, 11, 0, 2, 4, 5, 7};
+  if (str.empty())
+    return -1;
+
+  const char letter = str.front() & ~0x20; // upper case
+  if (letter < 'A' || letter > 'G')
+    return -1;
+  note = pitch_classes[letter - 'A'];
+  str.remove_prefix(1);
+
+  while (!str.empty() && (str.front() == '#' || str.front() == 'b'))
+  {
+    note += str.front() == '#' ? 1 : -1;
+    str.remove_prefix(1);
+  }
+
+  int octave{};
+  if (!parse_int(str, octave))
+    return -1;
+
+  note += (octave + 1) * 12;
+  return note >= 0 && note < 128 ? note : -1;
+}
+
+zone_map parse_zones(std::string_view str) noexcept
+{
+  zone_map res{};
+  for_each_entry(
+      str,
+      [&](std::string_view entry)
+      {
+        int bus{}, low{}, high{}, group{};
+        if (!parse_choke(entry, group))
+          return;
+        const auto colon = entry.rfind(':');
+        if (colon == std::string_view::npos
+            || !parse_int(entry.substr(colon + 1), bus) || bus < 1
+            || bus > max_buses
+            || !parse_keys(entry.substr(0, colon), low, high))
+          return;
+
+        for (int k = low; k <= high; k++)
+        {
+          res.bus[k] = bus - 1;
+          res.choke[k] = group;
+        }
+      });
+  return res;
+}
+
+multisample parse_multisample(std::string_view str) noexcept
+{
+  multisample res{};
+  res.note_sample.fill(-1);
+  for_each_entry(
+      str,
+      [&](std::string_view entry)
+      {
+        key_sample s;
+        if (res.count == max_key_samples || !parse_choke(entry, s.choke))
+          return;
+
+        const auto colon = entry.find(':');
+        const auto at = entry.find('@');
+        const auto plus = entry.rfind('+');
+        if (colon == std::string_view::npos || at == std::string_view::npos
+            || plus == std::string_view::npos || !(colon < at && at < plus))
+          return;
+
+        if (!parse_keys(entry.substr(0, colon), s.low, s.high))
+          return;
+        s.root = parse_note(entry.substr(colon + 1, at - colon - 1));
+        if (s.root < 0
+            || !parse_int(entry.substr(at + 1, plus - at - 1), s.start)
+            || !parse_int(entry.substr(plus + 1), s.length) || s.start < 0
+            || s.length <= 0)
+          return;
+
+        const int k = res.count++;
+        res.samples[k] = s;
+        for (int n = s.low; n <= s.high; n++)
+          res.note_sample[n] = k;
+      });
+  return res;
+}
+
+std::string multisample_to_string(const multisample& map)
+{
+  std::string res;
+  char entry[64];
+  for (int k = 0; k < map.count; k++)
+  {
+    const auto& s = map.samples[k];
+    std::snprintf(
+        entry,
+        sizeof(entry),
+        "%s%d-%d:%d@%lld+%lld",
+        k > 0 ? ", " : "",
+        s.low,
+        s.high,
+        s.root,
+        (long long)s.start,
+        (long long)s.length);
+    res += entry;
+    if (s.choke > 0)
+      res += "/" + std::to_string(s.choke);
+  }
+  return res;
+}
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace Samplette
+{
+// Audio outputs of the node: the main one and the extra buses
+static constexpr const int max_buses{4};
+
+// MIDI note of a number such as "60" or a note name such as "C4", "F#2"
+// or "Bb-1", with C4 = 60. Returns -1 if the string is not a note.
+[[nodiscard]] int parse_note(std::string_view str) noexcept;
+
+// Output bus of each MIDI note, 0 being the main output
+using bus_map = std::array<int8_t, 128>;
+
+// Choke group of each MIDI note, 0 for none, see choke_bus
+using choke_map = std::array<int8_t, 128>;
+
+struct zone_map
+{
+  bus_map bus{};
+  choke_map choke{};
+};
+
+// Parses the "Zones" control: a list of "key:bus" or "low-high:bus"
+// entries separated by spaces, commas or semicolons, e.g.
+// "C1-B1:2, 48:3". Buses are numbered from 1, the main output.
+// An entry may add a choke group after a slash: with "42:1/1, 46:1/1",
+// a closed hi-hat on 42 cuts the open one on 46 and the other way round.
+// Later entries win over earlier ones; invalid entries are ignored and
+// the notes which are in no zone play on the main output, in no group.
+[[nodiscard]] zone_map parse_zones(std::string_view str) noexcept;
+
+// A multisample is several samples laid end to end in one sound, each
+// played on a range of keys. Frames are counted from the sound start.
+static constexpr const int max_key_samples{128};
+struct key_sample
+{
+  int64_t start{};
+  int64_t length{};
+  // Keys which play the sample
+  int low{};
+  int high{127};
+  // Note at which the sample plays at its original speed
+  int root{60};
+  // Choke group, 0 for none
+  int choke{};
+};
+
+struct multisample
+{
+  int count{};
+  std::array<key_sample, max_key_samples> samples{};
+  // Sample of each MIDI note, -1 to play the whole sound
+  std::array<int16_t, 128> note_sample{};
+};
+
+// Parses the "Key map" control: a list of "low-high:root@start+length"
+// or "key:root@start+length" entries separated like the zones, e.g.
+// "0-61:60@0+48000, 62-127:64@48000+52000". An empty map, or the notes in
+// no entry, play the whole sound at the root note of the process.
+// Entries may end with a choke group like the zones, e.g. "42:42@0+9000/1".
+[[nodiscard]] multisample parse_multisample(std::string_view str) noexcept;
+
+// Inverse of parse_multisample, with the keys as note numbers
+[[nodiscard]] std::string multisample_to_string(const multisample& map);
+}
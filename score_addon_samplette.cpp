@@ -23,6 +23,8 @@ score_addon_samplette::factories(
       score::ApplicationContext,
       FW<Process::ProcessModelFactory, Samplette::ProcessFactory>,
       FW<Process::LayerFactory, Samplette::LayerFactory>,
+      FW<Process::InspectorWidgetDelegateFactory,
+         Samplette::InspectorFactory>,
       FW<Execution::ProcessComponentFactory,
          Samplette::ProcessExecutorComponentFactory>>(ctx, key);
 }
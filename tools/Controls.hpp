@@ -0,0 +1,106 @@
+#pragma once
+// Controls of the process for the tools, by name
+#include <ossia/network/value/value.hpp>
+
+#include <cstring>
+#include <vector>
+
+namespace Samplette
+{
+// Same order and defaults as Model::for_each_control
+struct control_default
+{
+  const char* name;
+  ossia::value value;
+};
+
+inline std::vector<control_default> default_controls()
+{
+  return {
+      {"Trigger", false},
+      {"Polyphony", std::string{"Mono"}},
+      {"Root note", 40},
+      {"Gain", 1.f},
+      {"Start", 0.f},
+      {"Length", 100.f},
+      {"Loops", false},
+      {"Loop start", 0.f},
+      {"Pitch", 0.f},
+      {"Attack", 0.f},
+      {"Decay", 0.f},
+      {"Sustain", 1.f},
+      {"Release", 0.f},
+      {"Velocity", 0.f},
+      {"Fade", 0.f},
+      {"Snap", false},
+      {"Gate ramp", 5.f},
+      {"Bend range", 2},
+      {"MPE", false},
+      {"Engine", std::string{"Sinc"}},
+      {"Filter", std::string{"Off"}},
+      {"Cutoff", 20000.f},
+      {"Resonance", 0.f},
+      {"Filter env", 0.f},
+      {"Filter attack", 0.f},
+      {"Filter decay", 500.f},
+      {"Key track", 0.f},
+      {"Filter velocity", 0.f},
+      {"Choke group", 0},
+      {"Sync", false},
+      {"BPM", 120.f},
+      {"Beats", 0},
+      {"Storage", std::string{"Float"}},
+      {"Outputs", std::string{"Source"}},
+      {"Pan", 0.f},
+      {"Spread", 1.f},
+      {"Pan key track", 0.f},
+      {"Pan velocity", 0.f},
+      {"Pan random", 0.f},
+      {"Zones", std::string{}},
+      {"Limiter", false},
+      {"Ceiling", -0.3f},
+      {"Lookahead", 2.f},
+      {"Auto gain", false},
+      {"Grain size", 50.f},
+      {"Grain density", 20.f},
+      {"Grain position", 0.f},
+      {"Grain jitter", 0.f},
+      {"Grain window", std::string{"Hann"}},
+      {"Direction", std::string{"Forward"}},
+      {"Key map", std::string{}},
+  };
+}
+
+inline std::vector<ossia::value> default_values()
+{
+  std::vector<ossia::value> values;
+  for (auto& c : default_controls())
+    values.push_back(c.value);
+  return values;
+}
+
+// Index of a control in the values, or -1 if there is none of that name
+inline int control_index(const char* name)
+{
+  static const auto controls = default_controls();
+  for (std::size_t i = 0; i < controls.size(); i++)
+    if (std::strcmp(controls[i].name, name) == 0)
+      return i;
+  return -1;
+}
+
+// The value of the first control if there is none of that name
+inline const ossia::value&
+control(const std::vector<ossia::value>& values, const char* name)
+{
+  const int i = control_index(name);
+  return values[i < 0 ? 0 : i];
+}
+
+// Throws std::out_of_range if there is no control of that name
+inline ossia::value&
+control(std::vector<ossia::value>& values, const char* name)
+{
+  return values.at(std::size_t(control_index(name)));
+}
+}
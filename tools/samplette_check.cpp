@@ -0,0 +1,513 @@
+// Checks of the node rendered offline on generated sounds, for behaviours
+// which the reference renders of samplette_render do not cover.
+//
+//   samplette_check [name...]
+//
+// Runs the named checks, or all of them, and fails if any does.
+#include <Samplette/Freeze.hpp>
+#include <Samplette/Kernels.hpp>
+#include <Samplette/Kit.hpp>
+#include <Samplette/Prewarm.hpp>
+#include <Samplette/Zones.hpp>
+#include <tools/Controls.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+using namespace Samplette;
+
+constexpr double rate = 48000.;
+
+// One channel of `frames` frames going from 0 up to 1
+ossia::audio_handle ramp(int64_t frames)
+{
+  auto res = std::make_shared<ossia::audio_data>();
+  res->data.resize(1, std::vector<float>(frames));
+  for (int64_t i = 0; i < frames; i++)
+    res->data[0][i] = float(i) / frames;
+  return res;
+}
+
+render_job make_job(ossia::audio_handle sound)
+{
+  render_job job;
+  job.channels = sound->data.size();
+  job.sound = std::move(sound);
+  job.sound_rate = rate;
+  job.controls = default_values();
+  job.midi.sample_rate = rate;
+  job.midi.buffer_size = 512;
+  return job;
+}
+
+// The events stay in date order, as render_offline expects
+void add_note(render_job& job, int64_t on, int64_t off, uint8_t note = 60)
+{
+  auto& events = job.midi.events;
+  for (const midi_event& e :
+       {midi_event{on, {0x90, note, 127}, 3},
+        midi_event{off, {0x80, note, 0}, 3}})
+  {
+    events.insert(
+        std::upper_bound(
+            events.begin(),
+            events.end(),
+            e,
+            [](const midi_event& a, const midi_event& b)
+            { return a.date < b.date; }),
+        e);
+  }
+}
+
+bool finite(const ossia::audio_data& audio)
+{
+  for (const auto& c : audio.data)
+    for (float x : c)
+      if (!std::isfinite(x))
+        return false;
+  return true;
+}
+
+// A note held for long after the end of the filter envelope keeps a
+// finite cutoff, and its voice ends after the release.
+bool filter_envelope_long_hold()
+{
+  auto job = make_job(ramp(4800));
+  control(job.controls, "Loops") = true;
+  control(job.controls, "Filter") = std::string{"Low-pass"};
+  control(job.controls, "Cutoff") = 1000.f;
+  control(job.controls, "Filter env") = 2.f;
+  control(job.controls, "Filter decay") = 10.f;
+  const int64_t off = 5 * rate;
+  add_note(job, 0, off);
+  job.max_tail = 5.;
+
+  const auto audio = render_offline(job);
+  if (!finite(*audio))
+    return false;
+  return int64_t(audio->data[0].size()) < off + rate;
+}
+
+// A looping region played in reverse loops over the same frames as
+// forwards: from the region end down to the loop start, from a sample or
+// from a compressed store.
+bool reverse_loop()
+{
+  const int64_t frames = 1000;
+  auto job = make_job(ramp(frames));
+  control(job.controls, "Root note") = 60;
+  control(job.controls, "Engine") = std::string{"Linear"};
+  control(job.controls, "Direction") = std::string{"Reverse"};
+  control(job.controls, "Loops") = true;
+  control(job.controls, "Start") = 20.f;
+  control(job.controls, "Length") = 75.f;
+  control(job.controls, "Loop start") = 25.f;
+  add_note(job, 0, 4000);
+
+  // Region [200; 800), looping over [400; 800)
+  const auto expected = [](int64_t k) { return (799 - k % 400) / 1000.f; };
+
+  for (const auto storage : {"Float", "16-bit", "Packed"})
+  {
+    control(job.controls, "Storage") = std::string{storage};
+    if (std::strcmp(storage, "Float") != 0)
+    {
+      const float* data = job.sound->data[0].data();
+      job.store = make_sample_store(
+          std::span<const float* const>{&data, 1},
+          frames,
+          sample_format_from_string(storage));
+    }
+
+    const auto audio = render_offline(job);
+    if (audio->data.empty() || audio->data[0].size() < 4000)
+      return false;
+    for (int64_t k = 0; k < 4000; k++)
+      if (std::abs(audio->data[0][k] - expected(k)) > 1e-4f)
+      {
+        std::printf(
+            "%s: frame %lld is %g instead of %g\n",
+            storage,
+            (long long)k,
+            audio->data[0][k],
+            expected(k));
+        return false;
+      }
+  }
+  return true;
+}
+
+// Choke groups cut the voices of the other instances of the group: the
+// voices of a polyphonic instance in a group play together.
+bool choke_group_polyphony()
+{
+  auto job = make_job(ramp(48000));
+  control(job.controls, "Polyphony") = std::string{"Poly"};
+  control(job.controls, "Engine") = std::string{"Linear"};
+  add_note(job, 0, 24000, 60);
+  add_note(job, 1000, 24000, 67);
+  const auto free = render_offline(job);
+
+  control(job.controls, "Choke group") = 1;
+  const auto grouped = render_offline(job);
+  return free->data == grouped->data;
+}
+
+// A note choke group, from the zones or the key map, also cuts the
+// voices of the same node: past the gate ramp of the cut voice, only the
+// second note is heard, and the group is kept by the key map string.
+bool choke_note_groups()
+{
+  const auto key_map = parse_multisample("60:60@0+48000/2, 67:60@0+48000/2");
+  if (multisample_to_string(key_map)
+      != "60-60:60@0+48000/2, 67-67:60@0+48000/2")
+    return false;
+
+  for (const auto& [name, value] :
+       {std::pair{"Zones", "60:1/1, 67:1/1"},
+        std::pair{"Key map", "60:60@0+48000/2, 67:60@0+48000/2"}})
+  {
+    auto job = make_job(ramp(48000));
+    control(job.controls, "Polyphony") = std::string{"Poly"};
+    control(job.controls, "Engine") = std::string{"Linear"};
+    control(job.controls, "Gate ramp") = 5.f;
+    control(job.controls, name) = std::string{value};
+    add_note(job, 1000, 24000, 67);
+    const auto alone = render_offline(job);
+    add_note(job, 0, 24000, 60);
+    const auto choked = render_offline(job);
+
+    const auto& a = alone->data[0];
+    const auto& b = choked->data[0];
+    if (a.size() != b.size() || a.size() < 20000)
+      return false;
+    for (std::size_t k = 1000 + 240; k < a.size(); k++)
+      if (a[k] != b[k])
+        return false;
+  }
+  return true;
+}
+
+// The "Trigger" control set through the inlet, as in frozen renders,
+// means the same as in the executor: true is Gate, where a note off cuts
+// the voice with the gate ramp instead of starting its release.
+bool trigger_mode_inlet()
+{
+  auto job = make_job(ramp(48000));
+  control(job.controls, "Engine") = std::string{"Linear"};
+  control(job.controls, "Release") = 500.f;
+  control(job.controls, "Gate ramp") = 5.f;
+  add_note(job, 0, 4800);
+  const int64_t after = 4800 + 2400;
+
+  control(job.controls, "Trigger") = false;
+  const auto trigger = render_offline(job);
+  control(job.controls, "Trigger") = true;
+  const auto gate = render_offline(job);
+  return trigger->data[0].size() > after && trigger->data[0][after] != 0.f
+         && (gate->data[0].size() <= after || gate->data[0][after] == 0.f);
+}
+
+// A sound with a compressed copy is played from it alone, with every
+// engine reading the sample: the float data given with it is not used.
+bool store_replaces_float()
+{
+  // Exact in 16-bit, so that both renders match
+  const int64_t frames = 48000;
+  auto sound = ramp(frames);
+  for (float& x : sound->data[0])
+    x = std::round(x * 32768.f) / 32768.f;
+  const float* data = sound->data[0].data();
+
+  auto silent = std::make_shared<ossia::audio_data>();
+  silent->data.resize(1, std::vector<float>(frames));
+
+  for (const auto format : {sample_format::Int16, sample_format::Packed16})
+  {
+    const auto store = make_sample_store(
+        std::span<const float* const>{&data, 1}, frames, format);
+    for (const auto engine : {"Linear", "Granular"})
+    {
+      auto job = make_job(sound);
+      control(job.controls, "Engine") = std::string{engine};
+      add_note(job, 0, 12000);
+      const auto expected = render_offline(job);
+
+      job.sound = silent;
+      job.store = store;
+      const auto audio = render_offline(job);
+      if (audio->data != expected->data)
+      {
+        std::printf(
+            "%s, format %d: the store is not played\n", engine, int(format));
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Packed samples decode back to the same 16-bit values from any frame,
+// including the jumps between the extremes and the blocks of silence,
+// and take less memory than 16-bit ones for smooth sounds.
+bool packed_store()
+{
+  const int64_t frames = 10 * packed_block + 17;
+  std::vector<float> noise(frames);
+  uint32_t seed = 1;
+  for (int64_t i = 0; i < frames; i++)
+  {
+    const int16_t v = seed = seed * 1664525u + 1013904223u;
+    if (i < 2 * packed_block)
+      noise[i] = v / 32768.f;
+    else if (i < 3 * packed_block)
+      noise[i] = i % 2 ? -1.f : 32767 / 32768.f;
+    else if (i >= 5 * packed_block)
+      noise[i] = std::sin(i * 0.001f) / 4.f;
+  }
+
+  const float* data = noise.data();
+  const std::span<const float* const> channels{&data, 1};
+  const auto packed
+      = make_sample_store(channels, frames, sample_format::Packed16);
+  const auto exact = make_sample_store(channels, frames, sample_format::Int16);
+  if (!packed
+      || packed_channel_bytes(
+             packed->data[0].data(), packed->data[0].size(), frames)
+             != packed->data[0].size())
+    return false;
+
+  std::vector<float> a(frames), b(frames);
+  const int64_t starts[]{0, 1, packed_block - 1, 1234};
+  for (const int64_t start : starts)
+  {
+    const int64_t n = frames - start;
+    packed->decode(0, start, n, a.data());
+    exact->decode(0, start, n, b.data());
+    if (!std::equal(a.begin(), a.begin() + n, b.begin()))
+    {
+      std::printf("decoding from frame %lld differs\n", (long long)start);
+      return false;
+    }
+  }
+
+  const auto smooth = std::span{noise}.subspan(5 * packed_block);
+  const float* smooth_data = smooth.data();
+  const auto small = make_sample_store(
+      std::span<const float* const>{&smooth_data, 1},
+      smooth.size(),
+      sample_format::Packed16);
+  return small->data[0].size() < smooth.size() * sizeof(int16_t) / 2;
+}
+
+// Kits read without their float data play and analyze from their store
+// as from the floats, and kits saved from the store alone get their
+// floats back from it.
+bool kit_store_only()
+{
+  const int64_t frames = 48000;
+  auto sound = ramp(frames);
+  for (float& x : sound->data[0])
+    x = std::round((2.f * x - 1.f) * 32767.f) / 32768.f;
+  const float* data = sound->data[0].data();
+  const auto store = make_sample_store(
+      std::span<const float* const>{&data, 1}, frames, sample_format::Int16);
+
+  const auto path
+      = (std::filesystem::temp_directory_path() / "samplette_check.samplette")
+            .string();
+  kit bundle;
+  bundle.sound = sound;
+  bundle.sample_rate = rate;
+  bundle.store = store;
+  if (!write_kit(path, bundle))
+    return false;
+  const auto compact = read_kit(path, false);
+  if (!compact || compact->sound || !compact->store)
+    return false;
+
+  // Packed channels have their own size in the file
+  bundle.store = make_sample_store(
+      std::span<const float* const>{&data, 1},
+      frames,
+      sample_format::Packed16);
+  const auto packed
+      = write_kit(path, bundle) ? read_kit(path, false) : nullptr;
+  if (!packed || !packed->store || packed->store->data != bundle.store->data)
+  {
+    std::printf("the packed store is not read back\n");
+    return false;
+  }
+  bundle.store = store;
+
+  auto job = make_job(sound);
+  control(job.controls, "Engine") = std::string{"Linear"};
+  add_note(job, 0, 12000);
+  const auto expected = render_offline(job);
+  job.sound = nullptr;
+  job.store = compact->store;
+  if (render_offline(job)->data != expected->data)
+  {
+    std::printf("the kit store is not played\n");
+    return false;
+  }
+
+  const auto a
+      = analyze_sample(std::span<const float* const>{&data, 1}, frames);
+  const auto b = analyze_sample(*compact->store);
+  if (a->block_peaks != b->block_peaks
+      || a->zero_crossings != b->zero_crossings || a->period != b->period)
+  {
+    std::printf("the analysis of the store differs\n");
+    return false;
+  }
+
+  bundle.sound = nullptr;
+  const bool ok = write_kit(path, bundle);
+  const auto full = ok ? read_kit(path) : nullptr;
+  std::filesystem::remove(path);
+  return full && full->sound && full->sound->data == sound->data;
+}
+
+// Locked memory of the process in kB, or -1 if the system does not say
+long locked_kb()
+{
+  std::ifstream status{"/proc/self/status"};
+  for (std::string line; std::getline(status, line);)
+    if (line.rfind("VmLck:", 0) == 0)
+      return std::stol(line.substr(6));
+  return -1;
+}
+
+// Pages locked twice, e.g. by a sound prepared again while the previous
+// one is still alive, stay locked until both locks are gone.
+bool page_locks_nest()
+{
+  std::vector<char> data(16 * page_size_hint);
+  const long before = locked_kb();
+  auto first = std::make_unique<page_locks>();
+  first->lock(data.data(), data.size());
+  const long locked = locked_kb();
+  // Not allowed to lock, or no way to tell
+  if (before < 0 || locked <= before)
+    return true;
+
+  page_locks second;
+  second.lock(data.data() + page_size_hint, data.size() / 2);
+  first.reset();
+  if (locked_kb() <= before)
+  {
+    std::printf("the pages were unlocked by the first lock\n");
+    return false;
+  }
+  second.unlock_all();
+  return locked_kb() == before;
+}
+
+// The interpolation kernels specialized for mono, stereo and unit ratios
+// give the same frames as the generic one, and the constant gain mix the
+// same as a flat gain curve.
+bool specialized_kernels()
+{
+  const int64_t frames = 256;
+  std::vector<std::vector<float>> data(3, std::vector<float>(4 * frames));
+  uint32_t seed = 1;
+  for (auto& c : data)
+    for (float& x : c)
+      x = int32_t(seed = seed * 1664525u + 1013904223u) / 2147483648.f;
+
+  std::vector<std::vector<double>> a(3, std::vector<double>(frames));
+  std::vector<std::vector<double>> b(3, std::vector<double>(frames));
+  double* pa[3]{a[0].data(), a[1].data(), a[2].data()};
+  double* pb[3]{b[0].data(), b[1].data(), b[2].data()};
+
+  using Data = std::vector<std::vector<float>>;
+  for (std::size_t channels = 1; channels <= 3; channels++)
+    for (const bool reverse : {false, true})
+      for (const double ratio : {1., 0.73, 1.61})
+      {
+        // Frame k of the playback is at first + k * dir
+        const int64_t first = reverse ? 4 * frames - 1 : 0;
+        const double position = 17.3;
+        select_interpolate<Data>(channels, reverse, ratio)(
+            data, channels, first, position, ratio, pa, 0, frames);
+        const auto generic
+            = reverse ? &interpolate<Data, 0, -1, false>
+                      : &interpolate<Data, 0, 1, false>;
+        generic(data, channels, first, position, ratio, pb, 0, frames);
+
+        // The unit kernel computes the fraction once instead of per frame
+        const double tolerance = ratio == 1. ? 1e-6 : 0.;
+        for (std::size_t c = 0; c < channels; c++)
+          for (int64_t j = 0; j < frames; j++)
+            if (std::abs(a[c][j] - b[c][j]) > tolerance)
+            {
+              std::printf(
+                  "%zu channels, reverse %d, ratio %g: frame %lld differs\n",
+                  channels,
+                  int(reverse),
+                  ratio,
+                  (long long)j);
+              return false;
+            }
+      }
+
+  std::vector<float> flat(frames, 1.f);
+  std::vector<double> in(frames);
+  for (int64_t j = 0; j < frames; j++)
+    in[j] = data[0][j];
+  std::fill(a[0].begin(), a[0].end(), 0.);
+  std::fill(b[0].begin(), b[0].end(), 0.);
+  mix_kernels[1](in.data(), nullptr, 0.37f, pa[0], frames);
+  mix_kernels[0](in.data(), flat.data(), 0.37f, pb[0], frames);
+  return a[0] == b[0];
+}
+
+struct check
+{
+  const char* name;
+  std::function<bool()> run;
+};
+
+const check checks[]{
+    {"filter_envelope_long_hold", filter_envelope_long_hold},
+    {"reverse_loop", reverse_loop},
+    {"choke_group_polyphony", choke_group_polyphony},
+    {"choke_note_groups", choke_note_groups},
+    {"trigger_mode_inlet", trigger_mode_inlet},
+    {"store_replaces_float", store_replaces_float},
+    {"packed_store", packed_store},
+    {"kit_store_only", kit_store_only},
+    {"page_locks_nest", page_locks_nest},
+    {"specialized_kernels", specialized_kernels},
+};
+}
+
+int main(int argc, char** argv)
+{
+  int failures = 0;
+  for (const auto& c : checks)
+  {
+    bool selected = argc <= 1;
+    for (int i = 1; i < argc; i++)
+      selected |= std::strcmp(argv[i], c.name) == 0;
+    if (!selected)
+      continue;
+
+    const bool ok = c.run();
+    failures += !ok;
+    std::printf("%s %s\n", ok ? "OK  " : "FAIL", c.name);
+  }
+  return failures > 0 ? 1 : 0;
+}
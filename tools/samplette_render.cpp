@@ -0,0 +1,614 @@
+// Headless renderer for Samplette: plays a MIDI file through the node with
+// a sample and a preset, writes the result and optionally compares it to a
+// reference render.
+//
+//   samplette_render --sample S.wav --midi M.mid [--preset P.txt]
+//                    [--rate 48000] [--buffer 512] --out O.wav
+//                    [--reference R.wav] [--tolerance 0]
+//   samplette_render --batch jobs.txt [--threads N] [--rate] [--buffer]
+//   samplette_render --bench --sample S.wav [--voices 128] [--seconds 10]
+//
+// Each line of a batch file is "sample midi preset out [reference]", with
+// "-" for no preset. Its inputs are relative to the batch file and its
+// outputs to the current directory: tools/reference holds the regression
+// set of the node. Presets are "Control name = value" lines, using the
+// names of the controls of the process. The sample can also be a
+// .samplette kit: the preset then applies over the controls of the kit.
+#include <Samplette/Freeze.hpp>
+#include <Samplette/Kit.hpp>
+#include <tools/Controls.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+using namespace Samplette;
+
+std::string trim(const std::string& s)
+{
+  const auto b = s.find_first_not_of(" \t\r\n\"");
+  const auto e = s.find_last_not_of(" \t\r\n\"");
+  return b == std::string::npos ? std::string{} : s.substr(b, e - b + 1);
+}
+
+ossia::value parse_value(const std::string& str)
+{
+  if (str == "true")
+    return true;
+  if (str == "false")
+    return false;
+
+  char* end{};
+  const float f = std::strtof(str.c_str(), &end);
+  if (!str.empty() && *end == '\0')
+    return f;
+  return str;
+}
+
+// Controls saved in a kit, by name. Unknown names are ignored, as in the
+// process.
+void apply_kit(const kit& bundle, std::vector<ossia::value>& values)
+{
+  const auto controls = default_controls();
+  for (const auto& [name, value] : bundle.controls)
+  {
+    auto it = std::find_if(
+        controls.begin(),
+        controls.end(),
+        [&](const control_default& c) { return name == c.name; });
+    if (it != controls.end())
+      values[it - controls.begin()] = value;
+  }
+}
+
+// Applied over the current values
+bool load_preset(const std::string& path, std::vector<ossia::value>& values)
+{
+  const auto controls = default_controls();
+  if (path.empty() || path == "-")
+    return true;
+
+  std::ifstream f{path};
+  if (!f)
+  {
+    std::fprintf(stderr, "Cannot open preset %s\n", path.c_str());
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(f, line))
+  {
+    line = trim(line);
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    const auto eq = line.find('=');
+    const auto name = trim(line.substr(0, eq));
+    auto it = std::find_if(
+        controls.begin(),
+        controls.end(),
+        [&](const control_default& c) { return name == c.name; });
+    if (eq == std::string::npos || it == controls.end())
+    {
+      std::fprintf(stderr, "Unknown preset line: %s\n", line.c_str());
+      return false;
+    }
+    values[it - controls.begin()] = parse_value(trim(line.substr(eq + 1)));
+  }
+  return true;
+}
+
+// Standard MIDI files, format 0 or 1, with a tempo map.
+// Reads past the end of the data give 0 and mark the reader as failed.
+struct midi_reader
+{
+  const std::vector<unsigned char>& data;
+  std::size_t pos{};
+  bool failed{};
+
+  bool has(std::size_t n) const
+  {
+    return pos <= data.size() && n <= data.size() - pos;
+  }
+  uint32_t be(int bytes)
+  {
+    if (!has(bytes))
+    {
+      failed = true;
+      pos = data.size();
+      return 0;
+    }
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++)
+      v = (v << 8) | data[pos++];
+    return v;
+  }
+  // At most 4 bytes, as in the standard
+  uint32_t vlq()
+  {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+    {
+      const unsigned char b = be(1);
+      v = (v << 7) | (b & 0x7F);
+      if (!(b & 0x80))
+        return v;
+    }
+    failed = true;
+    return v;
+  }
+  void skip(uint32_t n)
+  {
+    if (!has(n))
+      failed = true;
+    pos = has(n) ? pos + n : data.size();
+  }
+};
+
+struct timed_midi
+{
+  uint64_t tick{};
+  int order{};
+  bool tempo{};
+  uint32_t usec_per_quarter{};
+  unsigned char bytes[3]{};
+  uint8_t size{};
+};
+
+bool load_midi(const std::string& path, double rate, midi_capture& out)
+{
+  std::ifstream f{path, std::ios::binary};
+  if (!f)
+  {
+    std::fprintf(stderr, "Cannot open MIDI file %s\n", path.c_str());
+    return false;
+  }
+  const std::vector<unsigned char> data{
+      std::istreambuf_iterator<char>{f}, std::istreambuf_iterator<char>{}};
+  midi_reader r{data};
+
+  const auto invalid = [&]
+  {
+    std::fprintf(stderr, "Invalid MIDI file %s\n", path.c_str());
+    return false;
+  };
+
+  if (!r.has(14) || std::memcmp(data.data(), "MThd", 4) != 0)
+    return invalid();
+  r.pos = 4;
+  const uint32_t header_size = r.be(4);
+  r.be(2); // format
+  const uint32_t tracks = r.be(2);
+  const uint32_t division = r.be(2);
+  r.pos = 8;
+  r.skip(header_size);
+  if (r.failed || header_size < 6 || division == 0)
+    return invalid();
+  if (division & 0x8000)
+  {
+    std::fprintf(stderr, "SMPTE time division is not supported\n");
+    return false;
+  }
+
+  std::vector<timed_midi> events;
+  int order = 0;
+  for (uint32_t t = 0; t < tracks; t++)
+  {
+    if (!r.has(8))
+      return invalid();
+    const bool is_track = std::memcmp(data.data() + r.pos, "MTrk", 4) == 0;
+    r.pos += 4;
+    const uint32_t size = r.be(4);
+    if (!r.has(size))
+      return invalid();
+    const std::size_t end = r.pos + size;
+    if (!is_track)
+    {
+      r.pos = end;
+      continue;
+    }
+
+    uint64_t tick = 0;
+    unsigned char status = 0;
+    while (r.pos < end && !r.failed)
+    {
+      tick += r.vlq();
+      if (r.pos >= end)
+        return invalid();
+      unsigned char b = data[r.pos];
+      if (b & 0x80)
+      {
+        r.pos++;
+        if (b < 0xF0)
+          status = b;
+      }
+      else if (status != 0)
+      {
+        b = status; // Running status
+      }
+      else
+      {
+        return invalid();
+      }
+
+      if (b == 0xFF)
+      {
+        const unsigned char type = r.be(1);
+        const uint32_t len = r.vlq();
+        if (type == 0x51 && len == 3)
+        {
+          timed_midi e{tick, order++, true};
+          e.usec_per_quarter = r.be(3);
+          events.push_back(e);
+        }
+        else
+        {
+          r.skip(len);
+        }
+      }
+      else if (b == 0xF0 || b == 0xF7)
+      {
+        r.skip(r.vlq());
+      }
+      else
+      {
+        const int type = b & 0xF0;
+        const uint8_t size = (type == 0xC0 || type == 0xD0) ? 2 : 3;
+        timed_midi e{tick, order++};
+        e.size = size;
+        e.bytes[0] = b;
+        for (int i = 1; i < size; i++)
+          e.bytes[i] = r.be(1);
+        // Note on with a zero velocity is a note off
+        if (type == 0x90 && e.bytes[2] == 0)
+          e.bytes[0] = 0x80 | (b & 0x0F);
+        events.push_back(e);
+      }
+    }
+    // Events may not run past the end of their track
+    if (r.failed || r.pos > end)
+      return invalid();
+  }
+
+  std::stable_sort(
+      events.begin(),
+      events.end(),
+      [](const timed_midi& a, const timed_midi& b) {
+        return a.tick < b.tick || (a.tick == b.tick && a.order < b.order);
+      });
+
+  // Ticks to samples through the tempo map, 120 BPM by default
+  double seconds = 0.;
+  uint64_t last_tick = 0;
+  double usec_per_quarter = 500000.;
+  out.events.clear();
+  out.sample_rate = rate;
+  for (const auto& e : events)
+  {
+    seconds += (e.tick - last_tick) * usec_per_quarter / (1e6 * division);
+    last_tick = e.tick;
+    if (e.tempo)
+    {
+      usec_per_quarter = e.usec_per_quarter;
+      continue;
+    }
+
+    midi_event m;
+    m.date = std::llround(seconds * rate);
+    m.size = e.size;
+    std::copy_n(e.bytes, e.size, m.bytes);
+    out.events.push_back(m);
+  }
+  return true;
+}
+
+struct job_desc
+{
+  std::string sample, midi, preset, out, reference;
+};
+
+struct job_result
+{
+  bool ok{};
+  double max_error{};
+  double seconds{};
+  int64_t frames{};
+  int64_t latency{};
+};
+
+bool make_render_job(
+    const std::string& sample,
+    const std::string& preset,
+    render_job& job)
+{
+  job.controls = default_values();
+
+  int sound_rate{};
+  std::shared_ptr<const kit> bundle;
+  if (sample.ends_with(std::string{"."} + kit_extension))
+  {
+    if ((bundle = read_kit(sample)))
+    {
+      job.sound = bundle->sound;
+      sound_rate = bundle->sample_rate;
+      apply_kit(*bundle, job.controls);
+    }
+  }
+  else
+  {
+    job.sound = read_wav(sample, sound_rate);
+  }
+  if (!job.sound)
+  {
+    std::fprintf(stderr, "Cannot read sample %s\n", sample.c_str());
+    return false;
+  }
+  job.channels = job.sound->data.size();
+  job.sound_rate = sound_rate;
+
+  if (!load_preset(preset, job.controls))
+    return false;
+
+  std::vector<const float*> channels;
+  for (auto& c : job.sound->data)
+    channels.push_back(c.data());
+  const int64_t frames = job.sound->data[0].size();
+
+  if (ossia::convert<bool>(control(job.controls, "Snap")))
+    job.analysis = analyze_sample(channels, frames);
+
+  const auto format = sample_format_from_string(
+      ossia::convert<std::string>(control(job.controls, "Storage")));
+  if (bundle && bundle->store && bundle->store->format == format)
+    job.store = bundle->store;
+  else if (format != sample_format::Float32)
+    job.store = make_sample_store(channels, frames, format);
+  return true;
+}
+
+job_result run_job(const job_desc& desc, double rate, int buffer_size)
+{
+  job_result res;
+  render_job job;
+  if (!make_render_job(desc.sample, desc.preset, job))
+    return res;
+  if (!load_midi(desc.midi, rate, job.midi))
+    return res;
+  job.midi.buffer_size = buffer_size;
+
+  render_stats stats;
+  const auto audio = render_offline(job, &stats);
+  res.seconds = stats.seconds;
+  res.frames = audio->data.empty() ? 0 : audio->data[0].size();
+  res.latency = stats.latency;
+
+  if (!desc.out.empty() && !write_wav(desc.out, *audio, rate))
+  {
+    std::fprintf(stderr, "Cannot write %s\n", desc.out.c_str());
+    return res;
+  }
+
+  res.ok = true;
+  if (!desc.reference.empty())
+  {
+    int ref_rate{};
+    const auto ref = read_wav(desc.reference, ref_rate);
+    if (!ref || ref_rate != int(rate)
+        || ref->data.size() != audio->data.size())
+    {
+      std::fprintf(
+          stderr,
+          "%s: does not match the format of %s\n",
+          desc.out.c_str(),
+          desc.reference.c_str());
+      res.max_error = INFINITY;
+      return res;
+    }
+
+    // Renders stop on a block boundary: the longer one is compared to
+    // silence past the end of the shorter one.
+    for (std::size_t c = 0; c < ref->data.size(); c++)
+    {
+      const auto& a = ref->data[c];
+      const auto& b = audio->data[c];
+      for (std::size_t i = 0; i < std::max(a.size(), b.size()); i++)
+      {
+        const float x = i < a.size() ? a[i] : 0.f;
+        const float y = i < b.size() ? b[i] : 0.f;
+        res.max_error = std::max<double>(res.max_error, std::abs(x - y));
+      }
+    }
+  }
+  return res;
+}
+
+// Every voice of a chord held for the whole duration, then released
+int bench(const std::string& sample, int voices, double seconds, double rate)
+{
+  render_job job;
+  if (!make_render_job(sample, "-", job))
+    return 1;
+
+  // Polyphonic, looping so that the voices keep playing
+  control(job.controls, "Polyphony") = std::string{"Poly"};
+  control(job.controls, "Loops") = true;
+  job.midi.sample_rate = rate;
+  job.midi.buffer_size = 512;
+  job.max_tail = 1.;
+  for (int v = 0; v < voices; v++)
+  {
+    const uint8_t note = 24 + v % 80;
+    const uint8_t channel = (v / 80) & 0x0F;
+    job.midi.events.push_back({0, {uint8_t(0x90 | channel), note, 100}, 3});
+  }
+  for (int v = 0; v < voices; v++)
+  {
+    const uint8_t note = 24 + v % 80;
+    const uint8_t channel = (v / 80) & 0x0F;
+    job.midi.events.push_back(
+        {int64_t(seconds * rate), {uint8_t(0x80 | channel), note, 0}, 3});
+  }
+
+  for (const auto engine : {"Sinc", "Linear", "Granular"})
+  {
+    control(job.controls, "Engine") = std::string{engine};
+    render_stats stats;
+    const auto audio = render_offline(job, &stats);
+    const double rendered = audio->data[0].size() / rate;
+    std::printf(
+        "%s, %d voices: %.3f s for %.3f s of audio (%.1fx real-time), "
+        "first block with voices: %.1f us\n",
+        engine,
+        voices,
+        stats.seconds,
+        rendered,
+        rendered / stats.seconds,
+        stats.time_to_first_sample / 1000.);
+  }
+  return 0;
+}
+
+// The inputs of the jobs are relative to the batch file, and their
+// outputs to the current directory
+bool load_batch(const std::string& path, std::vector<job_desc>& jobs)
+{
+  std::ifstream f{path};
+  if (!f)
+  {
+    std::fprintf(stderr, "Cannot open batch file %s\n", path.c_str());
+    return false;
+  }
+
+  const auto dir = std::filesystem::path{path}.parent_path();
+  const auto input = [&](std::string& file)
+  {
+    if (!file.empty() && file != "-")
+      file = (dir / file).string();
+  };
+
+  std::string line;
+  while (std::getline(f, line))
+  {
+    if (trim(line).empty() || trim(line)[0] == '#')
+      continue;
+    std::istringstream s{line};
+    job_desc d;
+    s >> d.sample >> d.midi >> d.preset >> d.out >> d.reference;
+    if (d.out.empty())
+    {
+      std::fprintf(stderr, "Invalid batch line: %s\n", line.c_str());
+      return false;
+    }
+    input(d.sample);
+    input(d.midi);
+    input(d.preset);
+    input(d.reference);
+    jobs.push_back(std::move(d));
+  }
+  return true;
+}
+}
+
+int main(int argc, char** argv)
+{
+  std::map<std::string, std::string> args;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string key = argv[i];
+    if (key.rfind("--", 0) != 0)
+    {
+      std::fprintf(stderr, "Unexpected argument %s\n", argv[i]);
+      return 1;
+    }
+    if (key == "--bench")
+      args[key] = "1";
+    else if (i + 1 < argc)
+      args[key] = argv[++i];
+  }
+  const auto arg = [&](const char* key, const char* def = "")
+  {
+    auto it = args.find(key);
+    return it != args.end() ? it->second : std::string{def};
+  };
+
+  const double rate = std::stod(arg("--rate", "48000"));
+  const int buffer_size = std::stoi(arg("--buffer", "512"));
+  const double tolerance = std::stod(arg("--tolerance", "0"));
+
+  if (args.count("--bench"))
+    return bench(
+        arg("--sample"),
+        std::stoi(arg("--voices", "128")),
+        std::stod(arg("--seconds", "10")),
+        rate);
+
+  std::vector<job_desc> jobs;
+  if (args.count("--batch"))
+  {
+    if (!load_batch(arg("--batch"), jobs))
+      return 1;
+  }
+  else
+  {
+    jobs.push_back(
+        {arg("--sample"),
+         arg("--midi"),
+         arg("--preset", "-"),
+         arg("--out"),
+         arg("--reference")});
+  }
+
+  // Jobs share nothing, so the results do not depend on the thread count
+  std::vector<job_result> results(jobs.size());
+  std::atomic_size_t next{0};
+  const int threads = std::max(
+      1,
+      std::min<int>(
+          std::stoi(arg(
+              "--threads",
+              std::to_string(std::thread::hardware_concurrency()).c_str())),
+          jobs.size()));
+  {
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+      pool.emplace_back(
+          [&]
+          {
+            for (std::size_t j; (j = next++) < jobs.size();)
+              results[j] = run_job(jobs[j], rate, buffer_size);
+          });
+    for (auto& t : pool)
+      t.join();
+  }
+
+  int failures = 0;
+  for (std::size_t j = 0; j < jobs.size(); j++)
+  {
+    const auto& r = results[j];
+    const bool ok = r.ok && r.max_error <= tolerance;
+    failures += !ok;
+    std::printf(
+        "%s %s: %lld frames in %.3f s",
+        ok ? "OK  " : "FAIL",
+        jobs[j].out.c_str(),
+        (long long)r.frames,
+        r.seconds);
+    if (r.latency > 0)
+      std::printf(", latency %lld frames", (long long)r.latency);
+    if (!jobs[j].reference.empty())
+      std::printf(", max error %g", r.max_error);
+    std::printf("\n");
+  }
+  return failures > 0 ? 1 : 0;
+}